@@ -0,0 +1,353 @@
+/*
+ * Define functions for factoring numbers into primes.
+ */
+
+#ifndef FACTOR_HPP
+#define FACTOR_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "sieve.hpp"
+
+// Internal function, do not use.
+Long binary_gcd(Long a, Long b) {
+    if(a == 0 || b == 0) {
+        return a | b;
+    }
+    auto shift = __builtin_ctzll(a | b);
+    a >>= __builtin_ctzll(a);
+    while(b != 0) {
+        b >>= __builtin_ctzll(b);
+        if(a > b) {
+            std::swap(a, b);
+        }
+        b -= a;
+    }
+    return a << shift;
+}
+
+// Internal function, do not use.
+// Find a nontrivial factor of the odd composite number `n` using Brent's
+// variant of Pollard's rho method.
+Long pollard_brent(Long n) {
+    // Number of steps whose differences are multiplied before taking the gcd
+    static constexpr Long batch = 128;
+
+    Montgomery mont(n);
+    auto one = mont.to(1);
+    for(auto c = one;; c = mont.add(c, one)) {
+        auto f = [&](Long x) { return mont.add(mont.mul(x, x), c); };
+        auto diff = [](Long x, Long y) { return x > y ? x - y : y - x; };
+
+        auto y = mont.to(2);
+        auto x = y;
+        auto ys = y;
+        auto q = one;
+        Long g = 1;
+        for(Long r = 1; g == 1; r *= 2) {
+            x = y;
+            for(Long j = 0; j < r; j++) {
+                y = f(y);
+            }
+            for(Long k = 0; k < r && g == 1; k += batch) {
+                ys = y;
+                for(Long j = 0; j < std::min(batch, r - k); j++) {
+                    y = f(y);
+                    q = mont.mul(q, diff(x, y));
+                }
+                g = binary_gcd(q, n);
+            }
+        }
+        if(g == n) {
+            // The batched product hit a multiple of n, repeat the last batch
+            // one step at a time
+            do {
+                ys = f(ys);
+                g = binary_gcd(diff(x, ys), n);
+            } while(g == 1);
+        }
+        if(g != n) {
+            return g;
+        }
+    }
+}
+
+// Internal function, do not use.
+// Append the prime factors of `n`, which has no factors below 1024, to
+// `factors` (in no particular order).
+void factor_large(std::vector<Long> &factors, Long n) {
+    if(n == 1) {
+        return;
+    }
+    if(is_prime(n)) {
+        factors.push_back(n);
+        return;
+    }
+    auto d = pollard_brent(n);
+    factor_large(factors, d);
+    factor_large(factors, n / d);
+}
+
+/**
+ * Compute the prime factorization of the specified number.
+ *
+ * Small factors are found by trial division, for the remaining part prime
+ * factors are split off with Pollard's rho method (Brent's variant) until
+ * the Miller-Rabin test in `is_prime` says the rest is prime.
+ *
+ * @param n The number to factor.
+ * @return The prime factors of `n` in ascending order, each repeated according
+ *         to its multiplicity. Empty if `n` is 0 or 1.
+ */
+std::vector<Long> factorize(Long n) {
+    static constexpr Long trialLimit = 1024;
+    static const auto small = sieve(trialLimit);
+
+    std::vector<Long> factors;
+    if(n < 2) {
+        return factors;
+    }
+    for(auto p : small) {
+        if(p >= trialLimit || p * p > n) {
+            break;
+        }
+        while(n % p == 0) {
+            factors.push_back(p);
+            n /= p;
+        }
+    }
+    if(n < trialLimit * trialLimit) {
+        // No factor below the trial limit, so any rest is prime
+        if(n > 1) {
+            factors.push_back(n);
+        }
+        return factors;
+    }
+    auto large = factors.size();
+    factor_large(factors, n);
+    std::sort(factors.begin() + large, factors.end());
+    return factors;
+}
+
+/**
+ * Compute the prime factorizations of many numbers, using multiple threads.
+ *
+ * @param numbers The numbers to factor.
+ * @param threads The number of worker threads, or 0 to use one thread per
+ *        hardware thread.
+ * @return The results of `factorize` for every number, in the same order.
+ */
+std::vector<std::vector<Long>> factorize(const std::vector<Long> &numbers,
+        unsigned threads) {
+    // Number of inputs a worker takes at once, since the time needed for a
+    // single number varies a lot
+    static constexpr std::size_t chunkSize = 1024;
+
+    if(threads == 0) {
+        threads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    std::vector<std::vector<Long>> result(numbers.size());
+    std::atomic<std::size_t> next(0);
+    auto worker = [&]() {
+        for(std::size_t first; (first = next.fetch_add(chunkSize))
+                < numbers.size();) {
+            auto last = std::min(first + chunkSize, numbers.size());
+            for(auto j = first; j < last; j++) {
+                result[j] = factorize(numbers[j]);
+            }
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for(unsigned t = 1; t < threads; t++) {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for(auto &t : pool) {
+        t.join();
+    }
+    return result;
+}
+
+/**
+ * A table of the smallest prime factor of every number up to a limit, for
+ * factoring many small numbers quickly.
+ *
+ * Only odd numbers are stored, as the index of their smallest prime factor in
+ * the list of odd primes up to the square root of the limit, or 0 if the
+ * number is prime. For limits up to 2^32 there are less than 2^16 such primes,
+ * so this needs one byte per number. The table is filled one cache sized
+ * segment at a time.
+ */
+class FactorTable
+{
+    // Number of odd numbers in a segment
+    static constexpr Long segmentSize = 1 << 17;
+
+    Long mLimit;
+    std::vector<std::uint32_t> mPrimes;
+    std::vector<std::uint16_t> mIndex;
+
+public:
+    /**
+     * Construct a FactorTable for numbers up to the specified limit.
+     *
+     * @param limit The maximum number that can be factored (inclusive), must be
+     *        less than 2^32.
+     */
+    explicit FactorTable(Long limit) : mLimit(limit), mIndex(limit / 2 + 1) {
+        auto small = sieve(isqrt(limit));
+        mPrimes.assign(small.begin() + std::min<std::size_t>(1, small.size()),
+                small.end());
+
+        // Entry `j` is the odd number `2 j + 1`. Primes are crossed off in
+        // descending order, so the smallest factor is written last.
+        for(Long lo = 0; lo < mIndex.size(); lo += segmentSize) {
+            auto hi = std::min<Long>(lo + segmentSize, mIndex.size());
+            for(auto k = mPrimes.size(); k > 0; k--) {
+                Long p = mPrimes[k - 1];
+                // Odd multiples of p are at j = (p - 1) / 2 + m p
+                auto first = std::max(p * p / 2,
+                        lo + ((p - 1) / 2 + p - lo % p) % p);
+                for(auto j = first; j < hi; j += p) {
+                    mIndex[j] = k;
+                }
+            }
+        }
+    }
+
+    /**
+     * Get the maximum number covered by the table (inclusive).
+     */
+    Long limit() const {
+        return mLimit;
+    }
+
+    /**
+     * Find the smallest prime factor of the specified number.
+     *
+     * @param n The number, must be at least 2 and not greater than `limit()`.
+     * @return The smallest prime factor of `n`.
+     */
+    Long smallest_factor(Long n) const {
+        if(n % 2 == 0) {
+            return 2;
+        }
+        auto k = mIndex[n / 2];
+        return k == 0 ? n : mPrimes[k - 1];
+    }
+
+    /**
+     * Compute the prime factorization of the specified number.
+     *
+     * @param n The number to factor, must not be greater than `limit()`.
+     * @return The prime factors of `n` in ascending order, each repeated
+     *         according to its multiplicity. Empty if `n` is 0 or 1.
+     */
+    std::vector<Long> factorize(Long n) const {
+        std::vector<Long> factors;
+        if(n == 0) {
+            return factors;
+        }
+        while(n > 1) {
+            auto p = smallest_factor(n);
+            factors.push_back(p);
+            n /= p;
+        }
+        return factors;
+    }
+}; // FactorTable
+
+/**
+ * Compute a multiplicative function for all numbers up to a limit.
+ *
+ * The numbers are factored one cache sized segment at a time by dividing out
+ * every prime up to the square root of the limit from its multiples, whatever
+ * is left over is a single prime factor.
+ *
+ * @param limit The maximum number (inclusive), must be less than 2^32.
+ * @param f The function for prime powers, called as `f(p, e, q)` with
+ *        `q = p^e` and returning a `T`.
+ * @return A vector with the values of the function for all numbers from 0 to
+ *         `limit`, where the value for 0 is `T()` and the value for 1 is
+ *         `T(1)`.
+ */
+template <typename T, typename F>
+std::vector<T> multiplicative_sieve(Long limit, F f) {
+    static constexpr Long segmentSize = 1 << 15;
+
+    auto primes = sieve(isqrt(limit));
+    std::vector<T> result(limit + 1, T(1));
+    result[0] = T();
+    std::vector<std::uint32_t> rest(segmentSize);
+    for(Long lo = 1; lo <= limit; lo += segmentSize) {
+        auto hi = std::min(limit, lo + segmentSize - 1);
+        for(auto n = lo; n <= hi; n++) {
+            rest[n - lo] = n;
+        }
+        for(auto p : primes) {
+            if(p * p > hi) {
+                break;
+            }
+            for(auto n = std::max(p, (lo + p - 1) / p * p); n <= hi; n += p) {
+                auto r = rest[n - lo];
+                unsigned e = 0;
+                Long q = 1;
+                do {
+                    r /= p;
+                    e++;
+                    q *= p;
+                } while(r % p == 0);
+                rest[n - lo] = r;
+                result[n] *= f(p, e, q);
+            }
+        }
+        for(auto n = lo; n <= hi; n++) {
+            if(rest[n - lo] > 1) {
+                result[n] *= f(rest[n - lo], 1, rest[n - lo]);
+            }
+        }
+    }
+    return result;
+}
+
+/**
+ * Compute Euler's totient function for all numbers up to a limit.
+ *
+ * @param limit The maximum number (inclusive), must be less than 2^32.
+ * @return A vector with `phi(n)` for all `n` from 0 to `limit`.
+ */
+std::vector<std::uint32_t> totients(Long limit) {
+    return multiplicative_sieve<std::uint32_t>(limit,
+            [](Long p, unsigned, Long q) { return q / p * (p - 1); });
+}
+
+/**
+ * Compute the number of divisors for all numbers up to a limit.
+ *
+ * @param limit The maximum number (inclusive), must be less than 2^32.
+ * @return A vector with the number of divisors of `n` for all `n` from 0 to
+ *         `limit`.
+ */
+std::vector<std::uint16_t> divisor_counts(Long limit) {
+    return multiplicative_sieve<std::uint16_t>(limit,
+            [](Long, unsigned e, Long) { return e + 1; });
+}
+
+/**
+ * Compute the Moebius function for all numbers up to a limit.
+ *
+ * @param limit The maximum number (inclusive), must be less than 2^32.
+ * @return A vector with `mu(n)` for all `n` from 0 to `limit`.
+ */
+std::vector<std::int8_t> mobius(Long limit) {
+    return multiplicative_sieve<std::int8_t>(limit,
+            [](Long, unsigned e, Long) { return e == 1 ? -1 : 0; });
+}
+
+#endif // FACTOR_HPP
@@ -0,0 +1,90 @@
+/*
+ * Define an allocator for large arrays that are backed by huge pages.
+ *
+ * This uses POSIX memory mapping and Linux specific flags, it is not available
+ * on other systems.
+ */
+
+#ifndef HUGE_PAGES_HPP
+#define HUGE_PAGES_HPP
+
+#include <cstddef>
+#include <new>
+#include <vector>
+
+#include <sys/mman.h>
+
+/**
+ * An allocator that maps every allocation as its own anonymous memory region
+ * backed by huge pages.
+ *
+ * Explicit huge pages (`MAP_HUGETLB`) are used if the system has enough of
+ * them, otherwise the region is mapped normally and marked for transparent
+ * huge pages. In that case only the address space is reserved
+ * (`MAP_NORESERVE`), so pages that are never written do not use any memory.
+ * This makes it cheap to reserve a vector for an upper bound of its size up
+ * front: it is never reallocated, and a prime table of several gigabytes needs
+ * a few thousand TLB entries instead of a million.
+ *
+ * Every allocation takes at least one huge page, so this is only useful for
+ * large arrays.
+ */
+template <typename T>
+class HugePageAllocator
+{
+    static constexpr std::size_t pageSize = 2 << 20;
+
+    static std::size_t roundUp(std::size_t n) {
+        return (n * sizeof(T) + pageSize - 1) / pageSize * pageSize;
+    }
+
+public:
+    using value_type = T;
+
+    HugePageAllocator() = default;
+
+    template <typename U>
+    HugePageAllocator(const HugePageAllocator<U>&) {
+    }
+
+    T *allocate(std::size_t n) {
+        auto size = roundUp(n);
+        // Explicit huge pages must be reserved, otherwise the mapping succeeds
+        // even if there are not enough of them and fails on the first access
+        auto p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if(p == MAP_FAILED) {
+            p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            if(p == MAP_FAILED) {
+                throw std::bad_alloc();
+            }
+            // Only a hint, the system may not support transparent huge pages
+            ::madvise(p, size, MADV_HUGEPAGE);
+        }
+        return static_cast<T *>(p);
+    }
+
+    void deallocate(T *p, std::size_t n) {
+        ::munmap(p, roundUp(n));
+    }
+}; // HugePageAllocator
+
+template <typename T, typename U>
+bool operator==(const HugePageAllocator<T>&, const HugePageAllocator<U>&) {
+    return true;
+}
+
+template <typename T, typename U>
+bool operator!=(const HugePageAllocator<T>&, const HugePageAllocator<U>&) {
+    return false;
+}
+
+/**
+ * A vector backed by huge pages, for example for large prime tables:
+ * `auto primes = sieve<Long, HugePageAllocator<Long>>(limit);`.
+ */
+template <typename T>
+using HugePageVector = std::vector<T, HugePageAllocator<T>>;
+
+#endif // HUGE_PAGES_HPP
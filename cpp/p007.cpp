@@ -7,16 +7,15 @@
  * What is the 10'001st prime number?
  */
 
+#include <cstddef>
 #include <iostream>
-#include <vector>
 
 #include "sieve.hpp"
 
 constexpr std::size_t index = 10'001;
 
 int main(int, char **) {
-    std::vector<Long> primes;
-    auto p = sieve(primes, index);
+    auto p = nth_prime(index);
 
     std::cout << "Project Euler - Problem 7: 10'001st prime\n\n";
     std::cout << "The " << index;
@@ -7,16 +7,13 @@
  */
 
 #include <iostream>
-#include <numeric>
-#include <vector>
 
 #include "sieve.hpp"
 
 constexpr Long limit = 2'000'000;
 
 int main(int, char **) {
-    auto primes = sieve(limit - 1);
-    auto sum = std::accumulate(primes.begin(), primes.end(), Long());
+    auto sum = static_cast<Long>(prime_sum(limit - 1));
 
     std::cout << "Project Euler - Problem 10: Summation of primes\n\n";
     std::cout << "The sum of all prime numbers below " << limit << " is\n"
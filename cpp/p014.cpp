@@ -17,32 +17,346 @@
  */
 
 #include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
 #include <iostream>
 #include <iterator>
+#include <limits>
 #include <stdexcept>
+#include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
-// Forward declaration
-long countCollatz(long init) throw(std::invalid_argument, std::domain_error);
+using namespace std::string_literals;
 
-constexpr long maxNumber = 1'000'000;
+/**
+ * A jump of several steps in a Collatz sequence.
+ */
+struct Jump
+{
+    std::uint32_t mul;
+    std::uint32_t add;
+    std::uint32_t steps;
+};
+
+// Number of halving steps a jump makes
+constexpr unsigned jumpBits = 16;
+
+/**
+ * Get the table for following Collatz sequences `jumpBits` steps at once.
+ *
+ * With `T(n) = n / 2` for even and `T(n) = (3 n + 1) / 2` for odd n, applying
+ * T k times to `n = a 2^k + b` gives `3^c a + d`, where c is the number of
+ * odd numbers on the way. The parities, and so c and d, only depend on b, so
+ * entry b of the table holds `3^c`, d and the number of steps in the original
+ * sequence, `k + c`. For `n >= 2^k` the sequence cannot reach 1 before the
+ * end of the jump.
+ */
+const std::vector<Jump> &jumps() {
+    static const auto table = []() {
+        std::vector<Jump> table(1 << jumpBits);
+        for(std::uint32_t b = 0; b < table.size(); b++) {
+            std::uint64_t d = b;
+            std::uint32_t mul = 1;
+            std::uint32_t odd = 0;
+            for(unsigned k = 0; k < jumpBits; k++) {
+                if(d % 2 == 0) {
+                    d /= 2;
+                } else {
+                    d = (3 * d + 1) / 2;
+                    mul *= 3;
+                    odd++;
+                }
+            }
+            table[b] = {mul, static_cast<std::uint32_t>(d), jumpBits + odd};
+        }
+        return table;
+    }();
+    return table;
+}
+
+/**
+ * A cache for the lengths of Collatz sequences.
+ *
+ * The lengths for numbers below a limit are kept in a dense table with two
+ * bytes per number (no sequence starting below 2^64 is known to have 2^16
+ * terms). The lengths for larger numbers can be kept in a hash table of fixed
+ * size, where a new entry simply replaces the one in its slot, so the memory
+ * needed does not depend on how far the sequences go. Most sequences fall
+ * below the dense limit after a few steps, so the hash table only pays off for
+ * scans far beyond the dense limit and is disabled by default.
+ *
+ * The cache can be shared by multiple threads. Entries are only ever replaced
+ * by correct values, so they are accessed without any ordering.
+ */
+class CollatzCache
+{
+    using Number = unsigned long long;
+
+    // A hash entry holds a number in the upper and its length in the lower
+    // bits, so only numbers below 2^48 are stored
+    static constexpr unsigned lengthBits = 16;
+    static constexpr Number maxHashed = Number(1) << (64 - lengthBits);
+
+    std::vector<std::atomic<std::uint16_t>> mDense;
+    std::vector<std::atomic<Number>> mHash;
+    unsigned mHashShift;
+
+    std::size_t slot(Number n) const {
+        // Fibonacci hashing, the upper bits of the product are well mixed
+        return (n * 0x9E3779B97F4A7C15ull) >> mHashShift;
+    }
+
+    // Get the cached length for n, or 0 if it is not cached.
+    long lookup(Number n) const {
+        if(n < mDense.size()) {
+            return mDense[n].load(std::memory_order_relaxed);
+        }
+        if(mHash.empty() || n >= maxHashed) {
+            return 0;
+        }
+        auto entry = mHash[slot(n)].load(std::memory_order_relaxed);
+        return entry >> lengthBits == n ? entry & 0xFFFF : 0;
+    }
+
+public:
+    /**
+     * Construct a CollatzCache.
+     *
+     * @param denseLimit The numbers below this limit are cached in the dense
+     *        table, which needs `2 denseLimit` bytes.
+     * @param hashBits The hash table for larger numbers has `2^hashBits`
+     *        entries of 8 bytes, or none if `hashBits` is 0.
+     */
+    CollatzCache(long denseLimit, unsigned hashBits)
+            : mDense(std::max(denseLimit, 2L)),
+              mHash(hashBits == 0 ? 0 : std::size_t(1) << hashBits),
+              mHashShift(64 - hashBits) {
+        mDense[1].store(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * Get the limit of the dense table (exclusive).
+     */
+    long denseLimit() const {
+        return mDense.size();
+    }
+
+    /**
+     * Count the length of the Collatz sequence for the specified number.
+     *
+     * The sequence is followed until it reaches a number whose length is
+     * cached, then the length is stored for the initial number and the
+     * numbers on the way that belong into the hash table. Numbers of at least
+     * `2^jumpBits` are followed with the jump table.
+     *
+     * @param init The initial value to start the sequence with.
+     * @return The number of terms in the sequence, including `init` and 1.
+     *
+     * @throws std::invalid_argument When `init` is not positive.
+     * @throws std::domain_error When an intermediate number overflows.
+     */
+    long length(long init) {
+        if(init < 1) {
+            throw std::invalid_argument("Initial number must be positive.");
+        }
+        Number next = init;
+        auto count = 0L;
+        long known;
+        // The numbers on the way that belong into the hash table, with the
+        // number of steps to reach them
+        thread_local std::vector<std::pair<Number, long>> path;
+        path.clear();
+        const auto &table = jumps();
+        while((known = lookup(next)) == 0) {
+            if(!mHash.empty() && next >= mDense.size() && next < maxHashed) {
+                path.emplace_back(next, count);
+            }
+            if(next >> jumpBits != 0) {
+                auto &jump = table[next & ((1 << jumpBits) - 1)];
+                Number tmp;
+                if(__builtin_mul_overflow(next >> jumpBits, Number(jump.mul),
+                        &tmp) || __builtin_add_overflow(tmp, jump.add, &next)) {
+                    throw std::domain_error("Intermediate number overflowed.");
+                }
+                count += jump.steps;
+                continue;
+            }
+            if(next % 2 == 0) {
+                next /= 2;
+            } else {
+                if(next > (std::numeric_limits<Number>::max() - 1) / 3) {
+                    throw std::domain_error("Intermediate number overflowed.");
+                }
+                next = next * 3 + 1;
+            }
+            count++;
+        }
+
+        auto total = count + known;
+        if(Number(init) < mDense.size()) {
+            mDense[init].store(total, std::memory_order_relaxed);
+        }
+        for(auto &p : path) {
+            mHash[slot(p.first)].store(p.first << lengthBits
+                    | (total - p.second), std::memory_order_relaxed);
+        }
+        return total;
+    }
+}; // CollatzCache
+
+/**
+ * The numbers producing the longest sequences in (part of) the scan.
+ */
+struct Longest
+{
+    long length = 0;
+    std::vector<long> values;
+
+    void add(long value, long count) {
+        if(count == length) {
+            values.push_back(value);
+        } else if(count > length) {
+            values.clear();
+            values.push_back(value);
+            length = count;
+        }
+    }
 
-int main(int, char **) {
-    std::vector<long> maxValues;
-    auto maxLength = 0L;
+    void merge(const Longest &other) {
+        if(other.length > length) {
+            *this = other;
+        } else if(other.length == length) {
+            values.insert(values.end(), other.values.begin(),
+                    other.values.end());
+        }
+    }
+}; // Longest
 
-    // Try brute force first, maybe there is a better way
-    for(auto j = 1L; j < maxNumber; j++) {
-        auto length = countCollatz(j);
-        if(length == maxLength) {
-            maxValues.push_back(j);
-        } else if(length > maxLength) {
-            maxValues.clear();
-            maxValues.push_back(j);
-            maxLength = length;
+/**
+ * Find the numbers in a range producing the longest Collatz sequences, using
+ * multiple threads.
+ *
+ * The numbers are handed out to the workers in chunks as they become idle,
+ * since the time needed for a chunk varies. Chunks are taken in ascending
+ * order, so the sequences mostly run into numbers that are already cached.
+ *
+ * @param cache The cache for the sequence lengths.
+ * @param lo The first number of the range.
+ * @param hi The end of the range (exclusive).
+ * @param skip A predicate for numbers that do not have to be tried.
+ * @param threads The number of worker threads.
+ * @return The longest length and all numbers producing it.
+ */
+template <typename F>
+Longest scanRange(CollatzCache &cache, long lo, long hi, F skip,
+        unsigned threads) {
+    // Number of values a worker takes at once
+    static constexpr long chunkSize = 4096;
+
+    std::vector<Longest> results(threads);
+    std::atomic<long> next(lo);
+    auto worker = [&](Longest &best) {
+        for(long first; (first = next.fetch_add(chunkSize)) < hi;) {
+            auto last = std::min(first + chunkSize, hi);
+            for(auto j = first; j < last; j++) {
+                if(!skip(j)) {
+                    best.add(j, cache.length(j));
+                }
+            }
         }
+    };
+
+    std::vector<std::thread> pool;
+    for(unsigned t = 1; t < threads; t++) {
+        pool.emplace_back(worker, std::ref(results[t]));
     }
+    worker(results[0]);
+    for(auto &t : pool) {
+        t.join();
+    }
+    for(unsigned t = 1; t < threads; t++) {
+        results[0].merge(results[t]);
+    }
+    return results[0];
+}
+
+/**
+ * Find the numbers below a limit producing the longest Collatz sequences,
+ * using multiple threads.
+ *
+ * A number n is skipped if another number below the limit has a longer
+ * sequence that runs through n: 2 n if `n < limit / 2`, and `(n - 1) / 3` if
+ * `n % 6 == 4` (except for 4, which is reached from 1 but 1 ends the
+ * sequence). The numbers below the dense limit of the cache are all counted
+ * anyway, since the longer sequences depend on them.
+ *
+ * @param cache The cache for the sequence lengths.
+ * @param limit The limit for the numbers (exclusive).
+ * @param threads The number of worker threads, or 0 to use one thread per
+ *        hardware thread.
+ * @return The longest length and all numbers producing it, in ascending order.
+ */
+Longest scan(CollatzCache &cache, long limit, unsigned threads) {
+    if(threads == 0) {
+        threads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    auto dense = std::min(cache.denseLimit(), limit);
+    auto result = scanRange(cache, 1, dense,
+            [](long) { return false; }, threads);
+    result.merge(scanRange(cache, std::max(dense, limit / 2), limit,
+            [](long n) { return n % 6 == 4 && n > 4; }, threads));
+    std::sort(result.values.begin(), result.values.end());
+    return result;
+}
+
+constexpr long defaultLimit = 1'000'000;
+constexpr unsigned defaultHashBits = 0;
+
+int main(int argc, char **argv) {
+    if(argc > 4 || (argc >= 2 && argv[1] == "--help"s)) {
+        std::cerr << "Usage: " << argv[0]
+                  << " [ limit [ cacheLimit [ hashBits ] ] ]\n";
+        std::cerr << "  Searches the numbers below limit (default "
+                  << defaultLimit << "), caching the lengths\n  for numbers "
+                  << "below cacheLimit (default limit) in a table and for "
+                  << "larger\n  numbers in a hash table with 2^hashBits "
+                  << "entries (default 0, disabled)\n";
+        return 2;
+    }
+
+    auto maxNumber = defaultLimit;
+    auto cacheLimit = -1L;
+    long hashBits = defaultHashBits;
+    try {
+        if(argc >= 2) {
+            maxNumber = std::stol(argv[1]);
+        }
+        if(argc >= 3) {
+            cacheLimit = std::stol(argv[2]);
+        }
+        if(argc >= 4) {
+            hashBits = std::stol(argv[3]);
+        }
+    } catch(std::logic_error&) {
+        maxNumber = 0;
+    }
+    if(cacheLimit < 0) {
+        cacheLimit = maxNumber;
+    }
+    if(maxNumber < 2 || hashBits < 0 || hashBits > 32) {
+        std::cerr << "Invalid arguments, the limit must be at least 2 and the "
+                  << "hash bits at most 32.\n";
+        return 2;
+    }
+
+    CollatzCache cache(cacheLimit, hashBits);
+    auto longest = scan(cache, maxNumber, 0);
+    auto maxLength = longest.length;
+    auto &maxValues = longest.values;
 
     std::cout << "Project Euler - Problem 14: Longest Collatz sequence\n\n";
     if(maxValues.size() == 1) {
@@ -58,32 +372,3 @@ int main(int, char **) {
         std::cout << '\n';
     }
 }
-
-/**
- * Count the length of the Collatz sequence for the specified number.
- *
- * @param init The initial value to start the sequence with.
- * @return The number of terms in the sequence, including `init` and 1.
- *
- * @throws std::invalid_argument When `init` is not positive.
- * @throws std::domain_error When an intermediate number overflows.
- */
-long countCollatz(long init) throw(std::invalid_argument, std::domain_error) {
-    if(init < 1) {
-        throw std::invalid_argument("Initial number must be positive.");
-    }
-    auto next = init;
-    auto count = 1L;
-    while(next != 1) {
-        if(next % 2 == 0) {
-            next /= 2;
-        } else {
-            auto last = std::exchange(next, next * 3 + 1);
-            if(next < last) {
-                throw std::domain_error("Intermediate number overflowed.");
-            }
-        }
-        count++;
-    }
-    return count;
-}
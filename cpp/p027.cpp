@@ -22,18 +22,70 @@
  */
 
 #include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <cstddef>
+#include <cstdint>
 #include <iostream>
 #include <iterator>
 #include <limits>
 #include <map>
 #include <ostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
 #include "sieve.hpp"
 
-bool isPrime(Long n);
+using namespace std::string_literals;
+
+/**
+ * A bitset of the prime numbers up to a limit.
+ *
+ * The bits of the odd numbers are stored in 32-bit words, so vector code can
+ * gather the bits of several numbers at once. Numbers above the limit are
+ * tested with `is_prime`.
+ */
+class PrimeBits
+{
+    Long mLimit;
+    std::vector<std::uint32_t> mWords;
+
+public:
+    explicit PrimeBits(Long limit) : mLimit(limit), mWords(limit / 64 + 1) {
+        sieve_range(3, limit, [this](Long p) {
+            mWords[p / 64] |= 1u << (p / 2 % 32);
+        });
+    }
+
+    Long limit() const {
+        return mLimit;
+    }
+
+    /**
+     * Get the words of the bitset, the bit of the odd number `n` is bit
+     * `n / 2 % 32` of word `n / 64`.
+     */
+    const std::uint32_t *data() const {
+        return mWords.data();
+    }
+
+    bool operator()(Long n) const {
+        if(n > mLimit) {
+            return is_prime(n);
+        }
+        if(n % 2 == 0) {
+            return n == 2;
+        }
+        return (mWords[n / 64] >> (n / 2 % 32) & 1) != 0;
+    }
+}; // PrimeBits
 
 /**
  * Represents a range of integers that can be iterated over.
@@ -132,10 +184,10 @@ public:
  */
 struct Formula
 {
-    int a;
-    int b;
+    long long a;
+    long long b;
 
-    explicit Formula(int b) : b(b) {
+    explicit Formula(long long b) : b(b) {
     }
     Formula() = default;
     Formula(const Formula&) = default;
@@ -144,22 +196,31 @@ struct Formula
     /**
      * Compute the product of `a` and `b`.
      */
-    explicit operator int() const {
+    explicit operator long long() const {
         return a * b;
     }
 
     /**
-     * Test whether the formula yields a prime number for the specified value.
+     * Compute the value of the formula for the specified n.
+     *
+     * The value is computed with 128 bits, for coefficients and values of n
+     * below 2^31 it always fits into a `Long`.
      *
-     * @param n The number to test.
-     * @return `true` if the formula yields a prime number, `false` otherwise.
+     * @param n The value for n.
+     * @return The value of the formula, or 0 if it is negative.
+     *
+     * @throws std::overflow_error If the value does not fit into a `Long`.
      */
-    bool operator()(int n) const {
-        auto tmp = n * n + a * n + b;
-        if(tmp < 2) {
-            return false;
+    Long value(int n) const {
+        using Signed = __int128;
+        auto tmp = Signed(n) * n + Signed(a) * n + b;
+        if(tmp < 0) {
+            return 0;
+        }
+        if(tmp > Signed(std::numeric_limits<Long>::max())) {
+            throw std::overflow_error("Formula value does not fit 64 bits.");
         }
-        return isPrime(static_cast<Long>(tmp));
+        return static_cast<Long>(tmp);
     }
 
     friend std::ostream& operator<<(std::ostream &os, const Formula &f) {
@@ -174,47 +235,421 @@ struct Formula
     }
 }; // Formula
 
-// Absolute value must be less than or equal
-constexpr int aLimit = 999;
-constexpr int bLimit = 1000;
+/**
+ * A function computing the number of consecutive primes produced by the
+ * formulas with the same b and `lanes` different values of a at once.
+ */
+struct Kernel
+{
+    std::size_t lanes;
+    void (*run)(const PrimeBits &bits, long long b, const long long *as,
+            int *counts);
+};
 
-int main(int, char**) {
-    Formula max{};
-    int maxCount = 0;
+/**
+ * Compute the number of consecutive primes produced by a formula, if the
+ * values up to `n - 1` are known to be prime.
+ */
+int finishRun(const PrimeBits &bits, const Formula &f, int n) {
+    Range r(n, std::numeric_limits<int>::max());
+    return *std::find_if_not(r.begin(), r.end(),
+            [&](int k) { return bits(f.value(k)); });
+}
 
-    // Since n starts with 0 in the above formula, we need only try values for
-    // b which are already prime (0^2 + 0 a + b must be prime).
-    Range r(std::numeric_limits<int>::max());
-    for(auto b : sieve(bLimit)) {
-        Formula f(b);
-        for(auto a = -aLimit; a <= aLimit; a++) {
-            f.a = a;
-            auto n = std::find_if_not(r.begin(), r.end(), f);
-            if(*n > maxCount) {
-                maxCount = *n;
-                max = f;
-            }
+void runScalar(const PrimeBits &bits, long long b, const long long *as,
+        int *counts) {
+    Formula f(b);
+    f.a = as[0];
+    counts[0] = finishRun(bits, f, 0);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/*
+ * The vector kernels evaluate the formulas for all lanes in lockstep, using
+ * `f(n + 1) = f(n) + d(n)` with `d(n) = 2 n + 1 + a`, until every lane has hit
+ * a value that is not prime. Values beyond the bitset are not looked up, those
+ * lanes are finished one at a time. All values must fit into 32-bit lanes.
+ */
+
+__attribute__((target("avx2")))
+void runAvx2(const PrimeBits &bits, long long b, const long long *as,
+        int *counts) {
+    int lanes[8];
+    std::copy(as, as + 8, lanes);
+    auto words = reinterpret_cast<const int *>(bits.data());
+    auto zero = _mm256_setzero_si256();
+    auto one = _mm256_set1_epi32(1);
+    auto two = _mm256_set1_epi32(2);
+    auto lowBits = _mm256_set1_epi32(31);
+    auto limit = _mm256_set1_epi32(static_cast<int>(bits.limit()));
+
+    auto v = _mm256_set1_epi32(static_cast<int>(b));
+    auto d = _mm256_add_epi32(one,
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(lanes)));
+    auto active = _mm256_set1_epi32(-1);
+    auto beyond = zero;
+    auto count = zero;
+    while(!_mm256_testz_si256(active, active)) {
+        auto big = _mm256_cmpgt_epi32(v, limit);
+        auto odd = _mm256_cmpeq_epi32(_mm256_and_si256(v, one), one);
+        auto probe = _mm256_andnot_si256(big, _mm256_and_si256(active,
+                _mm256_and_si256(odd, _mm256_cmpgt_epi32(v, one))));
+        auto word = _mm256_mask_i32gather_epi32(zero, words,
+                _mm256_srli_epi32(v, 6), probe, 4);
+        auto bit = _mm256_srlv_epi32(word,
+                _mm256_and_si256(_mm256_srli_epi32(v, 1), lowBits));
+        auto prime = _mm256_or_si256(_mm256_cmpeq_epi32(v, two),
+                _mm256_and_si256(probe,
+                        _mm256_cmpeq_epi32(_mm256_and_si256(bit, one), one)));
+        beyond = _mm256_or_si256(beyond, _mm256_and_si256(active, big));
+        active = _mm256_and_si256(active, prime);
+        count = _mm256_sub_epi32(count, active);
+        v = _mm256_add_epi32(v, d);
+        d = _mm256_add_epi32(d, two);
+    }
+
+    int escaped[8];
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(counts), count);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(escaped), beyond);
+    for(int k = 0; k < 8; k++) {
+        if(escaped[k] != 0) {
+            Formula f(b);
+            f.a = as[k];
+            counts[k] = finishRun(bits, f, counts[k]);
         }
     }
+}
 
-    std::cout << "Project Euler - Problem 27: Quadratic primes\n\n";
-    std::cout << "The formula producing the most consecutive primes ("
-              << maxCount << ") is\n  " << max << '\n';
-    std::cout << "The product of a and b is " << static_cast<int>(max) << '\n';
+__attribute__((target("avx512f")))
+void runAvx512(const PrimeBits &bits, long long b, const long long *as,
+        int *counts) {
+    int lanes[16];
+    std::copy(as, as + 16, lanes);
+    auto words = reinterpret_cast<const int *>(bits.data());
+    auto zero = _mm512_setzero_si512();
+    auto one = _mm512_set1_epi32(1);
+    auto two = _mm512_set1_epi32(2);
+    auto lowBits = _mm512_set1_epi32(31);
+    auto limit = _mm512_set1_epi32(static_cast<int>(bits.limit()));
+
+    auto v = _mm512_set1_epi32(static_cast<int>(b));
+    auto d = _mm512_add_epi32(one, _mm512_loadu_si512(lanes));
+    __mmask16 active = 0xFFFF;
+    __mmask16 beyond = 0;
+    auto count = zero;
+    while(active != 0) {
+        __mmask16 big = _mm512_cmpgt_epi32_mask(v, limit);
+        __mmask16 probe = active & ~big & _mm512_test_epi32_mask(v, one)
+                & _mm512_cmpgt_epi32_mask(v, one);
+        auto word = _mm512_mask_i32gather_epi32(zero, probe,
+                _mm512_maskz_srli_epi32(probe, v, 6), words, 4);
+        auto bit = _mm512_maskz_srlv_epi32(probe, word,
+                _mm512_and_si512(_mm512_maskz_srli_epi32(probe, v, 1),
+                        lowBits));
+        __mmask16 prime = (probe & _mm512_test_epi32_mask(bit, one))
+                | _mm512_cmpeq_epi32_mask(v, two);
+        beyond |= active & big;
+        active &= prime;
+        count = _mm512_mask_add_epi32(count, active, count, one);
+        v = _mm512_add_epi32(v, d);
+        d = _mm512_add_epi32(d, two);
+    }
+
+    _mm512_storeu_si512(counts, count);
+    for(int k = 0; k < 16; k++) {
+        if((beyond >> k & 1) != 0) {
+            Formula f(b);
+            f.a = as[k];
+            counts[k] = finishRun(bits, f, counts[k]);
+        }
+    }
 }
+#endif
 
 /**
- * Test whether the specified number is prime.
+ * Choose the widest kernel the CPU supports.
  *
- * @param n The number to test.
- * @return `true` if `n` is prime, `false` otherwise.
+ * @param bits The bitset for the primality tests.
+ * @param aLimit The maximum absolute value of a.
+ * @param bLimit The maximum value of b. The vector kernels are only used if
+ *        the values and their differences fit into 32-bit lanes.
+ */
+Kernel selectKernel(const PrimeBits &bits, long long aLimit,
+        long long bLimit) {
+#if defined(__x86_64__) || defined(__i386__)
+    if(bits.limit() < (1 << 30) && aLimit < (1 << 28) && bLimit < (1 << 30)) {
+        __builtin_cpu_init();
+        if(__builtin_cpu_supports("avx512f")) {
+            return {16, runAvx512};
+        }
+        if(__builtin_cpu_supports("avx2")) {
+            return {8, runAvx2};
+        }
+    }
+#else
+    static_cast<void>(bits);
+    static_cast<void>(aLimit);
+    static_cast<void>(bLimit);
+#endif
+    return {1, runScalar};
+}
+
+/**
+ * A formula found in the search.
  */
-bool isPrime(Long n) {
-    static std::vector<Long> primes;
+struct Result
+{
+    Formula formula{};
+    int count = 0;
+    // Position of the formula in the search order, for breaking ties
+    std::size_t index = 0;
+
+    /**
+     * Test whether this result is better than the other one. Of formulas with
+     * the same count the one that comes first in the search order is better,
+     * so the results do not depend on how the search is split up.
+     */
+    bool beats(const Result &other) const {
+        return count > other.count
+                || (count == other.count && index < other.index);
+    }
+}; // Result
 
-    if(n > 3 && n % 2 == 0) {
-        return false;
+/**
+ * The best formulas found in (part of) the search.
+ *
+ * Only a fixed number of results is kept in a heap with the worst one on top,
+ * so any number of formulas can be streamed through it.
+ */
+class TopResults
+{
+    std::size_t mSize;
+    std::vector<Result> mHeap;
+
+    static bool better(const Result &lhs, const Result &rhs) {
+        return lhs.beats(rhs);
+    }
+
+public:
+    /**
+     * Construct an empty TopResults.
+     *
+     * @param size The number of results to keep, must be at least 1.
+     */
+    explicit TopResults(std::size_t size) : mSize(size) {
+    }
+
+    /**
+     * Get the count a formula needs to have a chance to be added, which is 0
+     * until the results are full.
+     */
+    int threshold() const {
+        return mHeap.size() < mSize ? 0 : mHeap.front().count;
+    }
+
+    /**
+     * Add a result if it is one of the best so far.
+     */
+    void add(const Result &result) {
+        if(mHeap.size() < mSize) {
+            mHeap.push_back(result);
+            std::push_heap(mHeap.begin(), mHeap.end(), better);
+        } else if(result.beats(mHeap.front())) {
+            std::pop_heap(mHeap.begin(), mHeap.end(), better);
+            mHeap.back() = result;
+            std::push_heap(mHeap.begin(), mHeap.end(), better);
+        }
+    }
+
+    void merge(const TopResults &other) {
+        for(auto &r : other.mHeap) {
+            add(r);
+        }
+    }
+
+    /**
+     * Get the results, the best one first.
+     */
+    std::vector<Result> sorted() const {
+        auto results = mHeap;
+        std::sort(results.begin(), results.end(), better);
+        return results;
+    }
+}; // TopResults
+
+/**
+ * Find the formulas producing the most consecutive primes, using multiple
+ * threads.
+ *
+ * The (b, a) pairs are numbered in the order b, then a, and handed out to
+ * the workers in chunks as they become idle.
+ *
+ * Most formulas are decided without evaluating them: `f(1) = 1 + a + b` must
+ * be prime, which for odd b needs an odd a (unless `f(1) = 2`), otherwise the
+ * run ends after `f(0) = b`. And `f(b) = b (b + a + 1)` is composite unless
+ * `a = -b`, so no other formula produces more than b primes and a formula
+ * whose b is less than the count of the worst result kept so far can be
+ * skipped.
+ *
+ * The remaining formulas with the same b are collected and evaluated
+ * together by the kernel for the CPU.
+ *
+ * @param bits The bitset for the primality tests.
+ * @param bs The values to try for b, in ascending order.
+ * @param aLimit The maximum absolute value of a.
+ * @param size The number of formulas to find.
+ * @param threads The number of worker threads, or 0 to use one thread per
+ *        hardware thread.
+ * @return The best formulas, of formulas with the same count the first in the
+ *         search order.
+ */
+template <typename C>
+TopResults search(const PrimeBits &bits, const C &bs, long long aLimit,
+        std::size_t size, unsigned threads) {
+    // Number of pairs a worker takes at once
+    static constexpr std::size_t chunkSize = 256;
+
+    if(threads == 0) {
+        threads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    std::size_t aCount = 2 * aLimit + 1;
+    auto total = bs.size() * aCount;
+    auto kernel = selectKernel(bits, aLimit, bs.empty() ? 0 : bs.back());
+    // There cannot be more results than formulas
+    std::vector<TopResults> results(threads,
+            TopResults(std::min(size, total)));
+    std::atomic<std::size_t> next(0);
+    auto worker = [&](TopResults &best) {
+        // Formulas waiting for the kernel, all with the same b
+        std::vector<long long> as(kernel.lanes);
+        std::vector<std::size_t> indices(kernel.lanes);
+        std::vector<int> counts(kernel.lanes);
+        std::size_t pending = 0;
+        long long batchB = 0;
+        auto flush = [&]() {
+            if(pending == 0) {
+                return;
+            }
+            // Unused lanes repeat the last formula
+            std::fill(as.begin() + pending, as.end(), as[pending - 1]);
+            kernel.run(bits, batchB, as.data(), counts.data());
+            for(std::size_t k = 0; k < pending; k++) {
+                Formula f(batchB);
+                f.a = as[k];
+                best.add({f, counts[k], indices[k]});
+            }
+            pending = 0;
+        };
+
+        for(std::size_t first; (first = next.fetch_add(chunkSize)) < total;) {
+            auto last = std::min(first + chunkSize, total);
+            auto bIndex = first / aCount;
+            auto a = static_cast<long long>(first % aCount) - aLimit;
+            for(auto j = first; j < last; j++, a++) {
+                if(a > aLimit) {
+                    a = -aLimit;
+                    bIndex++;
+                }
+                Formula f(bs[bIndex]);
+                f.a = a;
+                if(f.b != batchB) {
+                    flush();
+                    batchB = f.b;
+                }
+                if(f.b > 2 && f.a % 2 == 0 && f.a != 1 - f.b) {
+                    best.add({f, 1, j});
+                } else if(!bits(f.value(1))) {
+                    best.add({f, 1, j});
+                } else if(f.b >= best.threshold() || f.a == -f.b) {
+                    as[pending] = f.a;
+                    indices[pending++] = j;
+                    if(pending == kernel.lanes) {
+                        flush();
+                    }
+                }
+            }
+        }
+        flush();
+    };
+
+    std::vector<std::thread> pool;
+    for(unsigned t = 1; t < threads; t++) {
+        pool.emplace_back(worker, std::ref(results[t]));
+    }
+    worker(results[0]);
+    for(auto &t : pool) {
+        t.join();
+    }
+    for(unsigned t = 1; t < threads; t++) {
+        results[0].merge(results[t]);
+    }
+    return results[0];
+}
+
+// Absolute value must be less than or equal
+constexpr long long defaultALimit = 999;
+constexpr long long defaultBLimit = 1000;
+
+// The coefficients must stay below 2^31, then all values fit into 64 bits
+constexpr long long maxLimit = (1LL << 31) - 1;
+
+int main(int argc, char **argv) {
+    if((argc != 1 && argc != 3 && argc != 4)
+            || (argc >= 2 && argv[1] == "--help"s)) {
+        std::cerr << "Usage: " << argv[0] << " [ aLimit bLimit [ count ] ]\n";
+        std::cerr << "  Searches |a| <= aLimit and |b| <= bLimit (default "
+                  << defaultALimit << " and " << defaultBLimit
+                  << ") and prints\n  the best count formulas (default 1)\n";
+        return 2;
+    }
+
+    auto aLimit = defaultALimit;
+    auto bLimit = defaultBLimit;
+    long long size = 1;
+    try {
+        if(argc >= 3) {
+            aLimit = std::stoll(argv[1]);
+            bLimit = std::stoll(argv[2]);
+        }
+        if(argc == 4) {
+            size = std::stoll(argv[3]);
+        }
+    } catch(std::logic_error&) {
+        aLimit = -1;
+    }
+    if(aLimit < 0 || aLimit > maxLimit || bLimit < 2 || bLimit > maxLimit
+            || size < 1) {
+        std::cerr << "Invalid arguments, the limits must be between 0 (2 for "
+                  << "b) and " << maxLimit << "\nand the count must be "
+                  << "positive.\n";
+        return 2;
+    }
+
+    // Except for `a = -b` no run is longer than b, so the values stay below
+    // this limit and are almost always looked up in the bitset. The bitset is
+    // limited to numbers below 2^30 (64 MB with one bit per odd number, and
+    // vector code can use 32-bit lanes), larger values are tested with
+    // `is_prime`.
+    PrimeBits bits(std::min<Long>(
+            Long(bLimit) * bLimit + Long(aLimit) * bLimit + bLimit,
+            (Long(1) << 30) - 1));
+
+    // Since n starts with 0 in the above formula, we need only try values for
+    // b which are already prime (0^2 + 0 a + b must be prime).
+    auto results = search(bits, sieve<std::uint32_t>(bLimit), aLimit, size,
+            0).sorted();
+    auto max = results[0].formula;
+    auto maxCount = results[0].count;
+
+    std::cout << "Project Euler - Problem 27: Quadratic primes\n\n";
+    std::cout << "The formula producing the most consecutive primes ("
+              << maxCount << ") is\n  " << max << '\n';
+    std::cout << "The product of a and b is " << static_cast<long long>(max)
+              << '\n';
+    if(results.size() > 1) {
+        std::cout << "\nThe " << results.size() << " best formulas are\n";
+        for(auto &r : results) {
+            std::cout << "  " << r.count << ": " << r.formula << '\n';
+        }
     }
-    sieve_limit(primes, n);
-    return std::binary_search(primes.begin(), primes.end(), n);
 }
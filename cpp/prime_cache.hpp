@@ -0,0 +1,250 @@
+/*
+ * Define a persistent prime number cache that is shared between processes.
+ *
+ * This uses POSIX file locking and memory mapping, it is not available on
+ * other systems.
+ */
+
+#ifndef PRIME_CACHE_HPP
+#define PRIME_CACHE_HPP
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "sieve.hpp"
+
+/**
+ * Header of a prime cache file.
+ *
+ * The header is followed by `bytes` bytes of sieve bits in the same mod 30
+ * wheel format the sieve uses for its segments: byte `j` represents the
+ * numbers `30 j + wheel[k]`, bit `k` is set if that number is prime. All
+ * fields are stored in native byte order.
+ */
+struct PrimeCacheHeader
+{
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t headerSize;
+    std::uint64_t bytes;
+};
+
+/**
+ * A read-only view of a prime cache file, which is extended when it does not
+ * cover the requested limit.
+ *
+ * The file is memory mapped, so its pages are shared by all processes using
+ * the same cache. Extending the file appends sieve segments after the data
+ * that is already there and only updates the header once they are written, so
+ * concurrent readers always see a consistent file.
+ */
+class PrimeCache
+{
+    static constexpr char fileMagic[8] = "EULERPC";
+    static constexpr std::uint32_t fileVersion = 1;
+    static constexpr std::size_t maxSegmentSize = 250'000;
+
+    int mFd;
+    void *mMap;
+    std::size_t mMapSize;
+    const unsigned char *mBits;
+    Long mBytes;
+
+    [[noreturn]] static void fail(const char *what) {
+        throw std::system_error(errno, std::generic_category(), what);
+    }
+
+    void lock(int operation) {
+        if(::flock(mFd, operation) != 0) {
+            fail("Failed to lock prime cache.");
+        }
+    }
+
+    // Read the header, or initialize it if the file is empty. The caller must
+    // hold a lock on the file.
+    PrimeCacheHeader readHeader() {
+        PrimeCacheHeader header{};
+        auto n = ::pread(mFd, &header, sizeof(header), 0);
+        if(n < 0) {
+            fail("Failed to read prime cache.");
+        }
+        if(n == 0) {
+            std::memcpy(header.magic, fileMagic, sizeof(header.magic));
+            header.version = fileVersion;
+            header.headerSize = sizeof(header);
+            header.bytes = 0;
+        } else if(n != sizeof(header)
+                || std::memcmp(header.magic, fileMagic, sizeof(header.magic))
+                || header.version != fileVersion
+                || header.headerSize < sizeof(header)) {
+            throw std::runtime_error("Prime cache has an unsupported format.");
+        }
+        return header;
+    }
+
+    // Append sieve segments until the file has at least `bytes` bytes of sieve
+    // bits. The caller must hold an exclusive lock on the file.
+    void extend(PrimeCacheHeader &header, Long bytes) {
+        std::vector<Long> base;
+        ::sieve_limit(base, isqrt(30 * bytes) + 1);
+        std::vector<unsigned char> mark(maxSegmentSize);
+        while(header.bytes < bytes) {
+            auto count = std::min<Long>(bytes - header.bytes, maxSegmentSize);
+            auto offset = 30 * header.bytes;
+            mark_segment(mark, offset, count, base.begin(), base.end());
+            if(offset == 0) {
+                // 1 is not a prime number
+                mark[0] &= 0xFE;
+            }
+            auto pos = header.headerSize + header.bytes;
+            if(::pwrite(mFd, mark.data(), count, pos)
+                    != static_cast<ssize_t>(count)) {
+                fail("Failed to write prime cache.");
+            }
+            header.bytes += count;
+        }
+        // Only publish the new data once it is completely written
+        if(::fdatasync(mFd) != 0
+                || ::pwrite(mFd, &header, sizeof(header), 0)
+                        != static_cast<ssize_t>(sizeof(header))) {
+            fail("Failed to write prime cache.");
+        }
+    }
+
+public:
+    /**
+     * Open the specified prime cache, creating or extending it if necessary.
+     * The file is only opened for writing if it has to be extended.
+     *
+     * @param filename The name of the cache file.
+     * @param limit The maximum number the cache must cover (inclusive).
+     *
+     * @throws std::system_error If the file cannot be opened, read, written or
+     *         mapped.
+     * @throws std::runtime_error If the file is not a valid prime cache.
+     */
+    PrimeCache(const std::string &filename, Long limit)
+            : mFd(-1), mMap(MAP_FAILED), mMapSize(0), mBits(nullptr),
+              mBytes(0) {
+        auto bytes = limit / 30 + 1;
+        try {
+            // A cache that already covers the limit is only read, so it can
+            // be used from a file that is not writable
+            PrimeCacheHeader header{};
+            mFd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+            if(mFd >= 0) {
+                lock(LOCK_SH);
+                header = readHeader();
+                ::flock(mFd, LOCK_UN);
+            } else if(errno != ENOENT) {
+                fail("Failed to open prime cache.");
+            }
+            if(mFd < 0 || header.bytes < bytes) {
+                // Another process may extend the file before it is opened
+                // again, so the header has to be read again
+                if(mFd >= 0) {
+                    ::close(mFd);
+                }
+                mFd = ::open(filename.c_str(), O_RDWR | O_CREAT | O_CLOEXEC,
+                        0644);
+                if(mFd < 0) {
+                    fail("Failed to open prime cache.");
+                }
+                lock(LOCK_EX);
+                header = readHeader();
+                if(header.bytes < bytes) {
+                    extend(header, bytes);
+                }
+                ::flock(mFd, LOCK_UN);
+            }
+
+            mBytes = header.bytes;
+            mMapSize = header.headerSize + header.bytes;
+            mMap = ::mmap(nullptr, mMapSize, PROT_READ, MAP_SHARED, mFd, 0);
+            if(mMap == MAP_FAILED) {
+                fail("Failed to map prime cache.");
+            }
+            mBits = static_cast<const unsigned char *>(mMap)
+                    + header.headerSize;
+        } catch(...) {
+            // Closing the file also releases its lock
+            if(mFd >= 0) {
+                ::close(mFd);
+            }
+            throw;
+        }
+    }
+
+    PrimeCache(const PrimeCache&) = delete;
+    PrimeCache& operator=(const PrimeCache&) = delete;
+
+    ~PrimeCache() {
+        ::munmap(mMap, mMapSize);
+        ::close(mFd);
+    }
+
+    /**
+     * Get the maximum number covered by the cache (inclusive).
+     */
+    Long limit() const {
+        return 30 * mBytes - 1;
+    }
+
+    /**
+     * Test whether the specified number is prime.
+     *
+     * @param n The number to test, must not be greater than `limit()`.
+     * @return `true` if `n` is prime, `false` otherwise.
+     */
+    bool contains(Long n) const {
+        if(n < 7) {
+            return n == 2 || n == 3 || n == 5;
+        }
+        auto bit = wheelIndex[n % 30];
+        return bit < 8 && (mBits[n / 30] >> bit & 1) != 0;
+    }
+
+    /**
+     * Fill the specified vector with prime numbers up to the specified limit,
+     * like the free function `sieve_limit` but reading the cache.
+     *
+     * @param primes A vector that will be filled with all prime numbers up to
+     *        and including `limit`. If the specified vector is not empty, it
+     *        must already contain the first `primes.size()` prime numbers.
+     * @param limit The maximum prime number to be found (inclusive), must not
+     *        be greater than `limit()`.
+     */
+    void sieve_limit(std::vector<Long> &primes, Long limit) const {
+        if(primes.empty()) {
+            primes = {2, 3, 5};
+        }
+        auto lo = primes.back() + 1;
+        if(lo > limit) {
+            return;
+        }
+        for(auto j = lo / 30; j <= limit / 30; j++) {
+            for(unsigned bits = mBits[j]; bits != 0; bits &= bits - 1) {
+                auto p = 30 * j + wheel[__builtin_ctz(bits)];
+                if(p >= lo && p <= limit) {
+                    primes.push_back(p);
+                }
+            }
+        }
+    }
+}; // PrimeCache
+
+constexpr char PrimeCache::fileMagic[8];
+
+#endif // PRIME_CACHE_HPP
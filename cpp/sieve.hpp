@@ -2,79 +2,951 @@
  * Define functions for finding prime numbers.
  */
 
+#ifndef SIEVE_HPP
+#define SIEVE_HPP
+
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <cmath>
 #include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 using Long = unsigned long long int;
+// For results that may not fit into a `Long`
+using Wide = unsigned __int128;
+
+#ifdef SIEVE_STATS
+
+#include <chrono>
+#include <ostream>
+
+/**
+ * Statistics about the work done by the sieve, collected over all sieve calls
+ * in all threads since the program started or the last call to `reset`.
+ *
+ * The statistics are only collected if `SIEVE_STATS` is defined before this
+ * header is included, otherwise all counting is compiled out.
+ */
+struct SieveStats
+{
+    // Segments sieved, and mark buffer bytes initialized for them
+    std::atomic<Long> segments{0};
+    std::atomic<Long> bytes{0};
+    // Multiples crossed off by primes visited directly in every segment, by
+    // primes with a running index in every segment, and from buckets
+    std::atomic<Long> smallCrossings{0};
+    std::atomic<Long> mediumCrossings{0};
+    std::atomic<Long> bucketCrossings{0};
+    // Primes found in sieved segments
+    std::atomic<Long> primes{0};
+    // Time spent crossing off multiples and reading out the marked segments
+    // (including the function called by `sieve_range`)
+    std::atomic<Long> markNanos{0};
+    std::atomic<Long> collectNanos{0};
+
+    void reset() {
+        for(auto counter : {&segments, &bytes, &smallCrossings,
+                &mediumCrossings, &bucketCrossings, &primes, &markNanos,
+                &collectNanos}) {
+            *counter = 0;
+        }
+    }
+
+    void write_json(std::ostream &out) const {
+        out << "{\"segments\": " << segments
+            << ", \"bytes\": " << bytes
+            << ", \"smallCrossings\": " << smallCrossings
+            << ", \"mediumCrossings\": " << mediumCrossings
+            << ", \"bucketCrossings\": " << bucketCrossings
+            << ", \"primes\": " << primes
+            << ", \"markSeconds\": " << markNanos * 1e-9
+            << ", \"collectSeconds\": " << collectNanos * 1e-9 << "}";
+    }
+};
+
+/**
+ * Get the statistics collected by the sieve.
+ */
+SieveStats &sieve_stats() {
+    static SieveStats stats;
+    return stats;
+}
+
+// Internal class, do not use.
+// Adds the time from construction to destruction to a counter.
+class SieveTimer
+{
+    std::atomic<Long> &mTotal;
+    std::chrono::steady_clock::time_point mStart;
+
+public:
+    explicit SieveTimer(std::atomic<Long> &total)
+            : mTotal(total), mStart(std::chrono::steady_clock::now()) {
+    }
+
+    ~SieveTimer() {
+        mTotal.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - mStart).count(),
+                std::memory_order_relaxed);
+    }
+};
+
+// Internal macros, do not use.
+#define SIEVE_COUNT(counter, n) \
+        (sieve_stats().counter.fetch_add((n), std::memory_order_relaxed))
+#define SIEVE_TIME(counter) SieveTimer sieveTimer(sieve_stats().counter)
+
+#else
+
+// Without statistics the count is not evaluated, so any variables only
+// needed for it are optimized away.
+#define SIEVE_COUNT(counter, n) ((void)sizeof(n))
+#define SIEVE_TIME(counter) ((void)0)
+
+#endif // SIEVE_STATS
+
+/*
+ * Segments are stored as a bit-packed mod 30 wheel: every byte represents 30
+ * consecutive integers, one bit per residue coprime to 30. Multiples of 2, 3
+ * and 5 are never stored, so a byte covers 30 numbers instead of one.
+ */
+
+// Residues modulo 30 coprime to 30, bit `j` of a segment byte is `wheel[j]`.
+constexpr Long wheel[8] = {1, 7, 11, 13, 17, 19, 23, 29};
+
+// Bit index for every residue modulo 30, 8 for residues not in the wheel.
+constexpr unsigned char wheelIndex[30] = {8, 0, 8, 8, 8, 8, 8, 1, 8, 8, 8, 2,
+        8, 3, 8, 8, 8, 4, 8, 5, 8, 8, 8, 6, 8, 8, 8, 8, 8, 7};
+
+/**
+ * A bitset of all prime numbers up to `N` that is computed at compile time.
+ *
+ * The bits use the same mod 30 wheel layout as the sieve segments, so the
+ * table takes `N / 30 + 1` bytes.
+ */
+template <std::size_t N>
+struct StaticPrimeBits
+{
+    static constexpr std::size_t bytes = N / 30 + 1;
+
+    unsigned char bits[bytes];
+    // Number of prime numbers up to `N`
+    std::size_t count;
+
+    constexpr StaticPrimeBits() : bits{}, count(0) {
+        for(std::size_t j = 0; j < bytes; j++) {
+            bits[j] = 0xFF;
+        }
+        // 1 is not a prime number
+        bits[0] = 0xFE;
+        for(std::size_t j = 0; 900 * j * j < 30 * bytes; j++) {
+            for(std::size_t k = 0; k < 8; k++) {
+                auto p = 30 * j + wheel[k];
+                if((bits[j] >> k & 1) == 0 || p * p >= 30 * bytes) {
+                    continue;
+                }
+                for(auto r : wheel) {
+                    auto v = p * (p + (r + 30 - p % 30) % 30);
+                    auto mask = static_cast<unsigned char>(
+                            ~(1u << wheelIndex[v % 30]));
+                    for(auto idx = v / 30; idx < bytes; idx += p) {
+                        bits[idx] &= mask;
+                    }
+                }
+            }
+        }
+        for(std::size_t k = 0; k < 8; k++) {
+            if(30 * (bytes - 1) + wheel[k] > N) {
+                bits[bytes - 1] &= ~(1u << k);
+            }
+        }
+
+        count = (N >= 2) + (N >= 3) + (N >= 5);
+        for(std::size_t j = 0; j < bytes; j++) {
+            for(unsigned b = bits[j]; b != 0; b &= b - 1) {
+                count++;
+            }
+        }
+    }
+
+    /**
+     * Test whether the specified number is prime.
+     *
+     * @param n The number to test.
+     * @return `true` if `n` is a prime number not greater than `N`, `false`
+     *         otherwise.
+     */
+    constexpr bool contains(Long n) const {
+        if(n > N) {
+            return false;
+        }
+        if(n < 7) {
+            return n == 2 || n == 3 || n == 5;
+        }
+        return wheelIndex[n % 30] < 8
+                && (bits[n / 30] >> wheelIndex[n % 30] & 1) != 0;
+    }
+}; // StaticPrimeBits
+
+// Internal struct, do not use.
+template <std::size_t N>
+struct StaticPrimeList
+{
+    static constexpr std::size_t size = StaticPrimeBits<N>().count;
+
+    // One more element, since arrays must not be empty
+    Long values[size + 1];
+
+    constexpr StaticPrimeList() : values{} {
+        StaticPrimeBits<N> table;
+        std::size_t count = 0;
+        for(Long p : {2, 3, 5}) {
+            if(p <= N) {
+                values[count++] = p;
+            }
+        }
+        for(std::size_t j = 0; j < table.bytes; j++) {
+            for(std::size_t k = 0; k < 8; k++) {
+                if(table.bits[j] >> k & 1) {
+                    values[count++] = 30 * j + wheel[k];
+                }
+            }
+        }
+    }
+};
 
 // Internal function, do not use.
-void do_sieve(std::vector<Long> &primes, std::vector<char> &mark, Long &offset,
-        Long limit, std::size_t maxSegmentSize) {
-    auto sq = [](Long x) { return x * x; };
+template <std::size_t N, std::size_t... I>
+constexpr std::array<Long, sizeof...(I)> make_static_primes(
+        const StaticPrimeList<N> &list, std::index_sequence<I...>) {
+    return {{list.values[I]...}};
+}
 
-    std::size_t segmentSize = std::min<Long>(sq(primes.back()), limit) - offset;
-    segmentSize = std::min(segmentSize, maxSegmentSize);
-    if(segmentSize == 0) {
-        // In case limit == offset
-        // (when called from sieve_limit with limit == primes.back() + 2)
-        segmentSize = 1;
+/**
+ * A bitset of all prime numbers up to `N`, computed at compile time.
+ */
+template <std::size_t N>
+constexpr StaticPrimeBits<N> staticPrimeBits{};
+
+/**
+ * An array of all prime numbers up to `N` in ascending order, computed at
+ * compile time.
+ */
+template <std::size_t N>
+constexpr auto staticPrimes = make_static_primes(StaticPrimeList<N>(),
+        std::make_index_sequence<StaticPrimeList<N>::size>());
+
+// Internal constant, do not use.
+// Prime numbers up to this limit are known at compile time, sieving starts
+// after them.
+constexpr std::size_t seedLimit = 1 << 16;
+
+// Internal function, do not use.
+// Fill an empty vector with the prime numbers known at compile time.
+template <typename T, typename A>
+void seed_primes(std::vector<T, A> &primes) {
+    primes.assign(staticPrimes<seedLimit>.begin(),
+            staticPrimes<seedLimit>.end());
+}
+
+// Internal function, do not use.
+// Initialize the segment starting at `base` (a multiple of 30) with a copy of
+// a precomputed pattern that has the multiples of 7, 11, 13, 17 and 19 already
+// crossed off. The pattern repeats every 7 * 11 * 13 * 17 * 19 bytes.
+template <typename N>
+void presieve(std::vector<unsigned char> &mark, N base, std::size_t bytes) {
+    static constexpr Long presievePrimes[] = {7, 11, 13, 17, 19};
+    static const auto pattern = [] {
+        std::vector<unsigned char> bits(7 * 11 * 13 * 17 * 19, 0xFF);
+        for(auto p : presievePrimes) {
+            for(auto r : wheel) {
+                auto v = p * r;
+                auto mask = static_cast<unsigned char>(
+                        ~(1u << wheelIndex[v % 30]));
+                for(auto idx = v / 30; idx < bits.size(); idx += p) {
+                    bits[idx] &= mask;
+                }
+            }
+        }
+        return bits;
+    }();
+
+    std::size_t pos = (base / 30) % pattern.size();
+    for(std::size_t j = 0; j < bytes;) {
+        auto count = std::min(bytes - j, pattern.size() - pos);
+        std::copy_n(pattern.begin() + pos, count, mark.begin() + j);
+        j += count;
+        pos = 0;
+    }
+    if(base == 0 && bytes > 0) {
+        // The pre-sieved primes themselves were crossed off
+        mark[0] |= 0x3E;
+    }
+    SIEVE_COUNT(segments, 1);
+    SIEVE_COUNT(bytes, bytes);
+}
+
+// Internal function, do not use.
+// Sieve the segment of `bytes` bytes starting at `base` with all primes in
+// [first, last). The type of `base` must be wide enough for the end of the
+// segment, the primes must fit into a `Long`.
+template <typename N, typename It>
+void mark_segment(std::vector<unsigned char> &mark, N base,
+        std::size_t bytes, It first, It last) {
+    SIEVE_TIME(markNanos);
+    // The end of the segment is capped, it may not fit into an `N`
+    N end = base + std::min<N>(30 * bytes - 1, ~N(0) - base);
+    Long crossings = 0;
+
+    presieve(mark, base, bytes);
+    for(auto it = first; it != last && N(*it) * *it <= end; ++it) {
+        auto p = static_cast<Long>(*it);
+        if(p < 23) {
+            continue;
+        }
+        // Only multiples `p * m` with `m` coprime to 30 are in the wheel. For
+        // every residue of `m` they are `30 p` (so `p` bytes) apart and always
+        // hit the same bit. Counted from a multiple of 30, the first one for
+        // every residue follows from a single remainder.
+        N start = std::max<N>(base, N(p) * p);
+        start -= start % 30;
+        Long rest = start % (30 * p);
+        Long firstByte = (start - base) / 30;
+        for(auto r : wheel) {
+            auto v = p * r < rest ? p * r + 30 * p - rest : p * r - rest;
+            auto bit = 1u << wheelIndex[p * r % 30];
+            auto mask = static_cast<unsigned char>(~bit);
+            auto idx = firstByte + v / 30;
+            for(; idx < bytes; idx += p) {
+                mark[idx] &= mask;
+            }
+            crossings += (idx - firstByte - v / 30) / p;
+        }
+    }
+    SIEVE_COUNT(smallCrossings, crossings);
+}
+
+// Internal function, do not use.
+// Call `f` for every prime in [lo, hi] in the marked segment starting at
+// `base`, in ascending order.
+template <typename N, typename F>
+void scan_segment(const std::vector<unsigned char> &mark, N base, N lo, N hi,
+        F &&f) {
+    SIEVE_TIME(collectNanos);
+    std::size_t bytes = (hi - base) / 30 + 1;
+    Long found = 0;
+    for(std::size_t j = 0; j < bytes; j++) {
+        for(unsigned bits = mark[j]; bits != 0; bits &= bits - 1) {
+            auto p = base + 30 * j + wheel[__builtin_ctz(bits)];
+            if(p >= lo && p <= hi) {
+                f(p);
+                found++;
+            }
+        }
+    }
+    SIEVE_COUNT(primes, found);
+}
+
+// Internal function, do not use.
+// Append all primes in [lo, hi] from the marked segment starting at `base` to
+// `out`, which must be able to hold `hi`.
+template <typename T, typename A>
+void collect_segment(std::vector<T, A> &out,
+        const std::vector<unsigned char> &mark, Long base, Long lo, Long hi) {
+    scan_segment(mark, base, lo, hi,
+            [&out](Long p) { out.push_back(static_cast<T>(p)); });
+}
+
+// Internal function, do not use.
+// Append all primes in [lo, hi] to `out`, `lo` must be greater than 5 since 2,
+// 3 and 5 are not part of the wheel. The range [first, last) must contain all
+// primes up to `sqrt(hi)` and must not be invalidated by appending to `out`
+// (it is only used before the first prime is added).
+template <typename T, typename A, typename It>
+void sieve_segment(std::vector<T, A> &out, std::vector<unsigned char> &mark,
+        Long lo, Long hi, It first, It last) {
+    auto base = lo - lo % 30;
+    std::size_t bytes = (hi - base) / 30 + 1;
+
+    mark.resize(std::max(mark.size(), bytes));
+    mark_segment(mark, base, bytes, first, last);
+    collect_segment(out, mark, base, lo, hi);
+}
+
+// Internal class, do not use.
+// Sieves consecutive segments of a fixed size, keeping the next multiple of
+// every sieving prime between segments. Primes smaller than a segment are
+// visited in every segment, larger ones hit a segment at most once per wheel
+// residue and are kept in a bucket per segment instead (the bucket sieve by
+// Oliveira e Silva), so a segment only visits the primes that actually hit it.
+class SegmentSieve
+{
+    // The next multiple of a prime for one wheel residue
+    struct Multiple
+    {
+        std::uint32_t prime;
+        // Byte index relative to the segment it is stored for
+        std::uint32_t index;
+        unsigned char mask;
+    };
+
+    Long mOffset;
+    std::size_t mBytes;
+    // Multiples above this are not needed
+    Long mLimit;
+    // Index of the next prime to be added for sieving
+    std::size_t mNext;
+    std::vector<Multiple> mMedium;
+    // Bucket `k` holds the large primes hitting the `k`th segment from now
+    std::deque<std::vector<Multiple>> mBuckets;
+
+    void add(Long p) {
+        auto m0 = std::max(mOffset / p + (mOffset % p != 0), p);
+        for(auto r : wheel) {
+            // Near 2^64 the multiple may not fit into a `Long`
+            auto v = Wide(p) * (m0 + (r + 30 - m0 % 30) % 30);
+            if(v > mLimit) {
+                continue;
+            }
+            auto index = static_cast<Long>(v / 30) - mOffset / 30;
+            auto mask = static_cast<unsigned char>(~(1u << wheelIndex[v % 30]));
+            if(p < mBytes) {
+                mMedium.push_back({static_cast<std::uint32_t>(p),
+                        static_cast<std::uint32_t>(index), mask});
+            } else {
+                bucket(index / mBytes).push_back({static_cast<std::uint32_t>(p),
+                        static_cast<std::uint32_t>(index % mBytes), mask});
+            }
+        }
     }
 
-    mark.reserve(segmentSize);
-    std::fill_n(mark.begin(), segmentSize, 1);
-    for(auto it = primes.begin(); sq(*it) < offset + segmentSize; ++it) {
-        // Round up to the next multiple of *it >= offset
-        auto start = ((offset + *it - 1) / *it) * *it;
-        for(auto idx = start - offset; idx < segmentSize; idx += *it) {
-            mark[idx] = 0;
+    std::vector<Multiple> &bucket(Long k) {
+        while(mBuckets.size() <= k) {
+            mBuckets.emplace_back();
         }
+        return mBuckets[k];
+    }
+
+public:
+    // Start sieving at `offset`, which must be a multiple of 30. Multiples of
+    // large primes above `limit` are dropped instead of being kept in buckets,
+    // so segments past the limit are not sieved completely.
+    SegmentSieve(Long offset, std::size_t bytes, Long limit = -1)
+            : mOffset(offset), mBytes(bytes), mLimit(limit), mNext(0) {
+    }
+
+    // Start of the next segment.
+    Long offset() const {
+        return mOffset;
     }
-    for(std::size_t j = 0; j < segmentSize; j++) {
-        if(mark[j]) {
-            primes.push_back(offset + j);
+
+    // Sieve the next segment into `mark`. The vector `primes` must contain all
+    // primes up to the square root of the end of the segment, it is only read
+    // during this call and may be extended between calls.
+    template <typename T, typename A>
+    void next(std::vector<unsigned char> &mark,
+            const std::vector<T, A> &primes) {
+        SIEVE_TIME(markNanos);
+        // The last segment may end beyond 2^64
+        auto last = mOffset
+                + std::min<Long>(30 * mBytes - 1, ~Long(0) - mOffset);
+        for(; mNext < primes.size(); mNext++) {
+            Long p = primes[mNext];
+            if(p > last / p) {
+                break;
+            }
+            if(p >= 23) {
+                add(p);
+            }
+        }
+
+        mark.resize(std::max(mark.size(), mBytes));
+        presieve(mark, mOffset, mBytes);
+        Long crossings = 0;
+        for(auto &m : mMedium) {
+            auto idx = m.index;
+            for(; idx < mBytes; idx += m.prime) {
+                mark[idx] &= m.mask;
+            }
+            crossings += (idx - m.index) / m.prime;
+            m.index = static_cast<std::uint32_t>(idx - mBytes);
+        }
+        SIEVE_COUNT(mediumCrossings, crossings);
+        // The bucket for this segment is only read, the multiples are moved on
+        // to later buckets
+        auto &current = bucket(0);
+        SIEVE_COUNT(bucketCrossings, current.size());
+        for(std::size_t j = 0; j < current.size(); j++) {
+            auto m = current[j];
+            mark[m.index] &= m.mask;
+            // Both fields are 32 bits, the sum may not be
+            auto idx = Long(m.index) + m.prime;
+            if(mOffset / 30 + idx > mLimit / 30) {
+                continue;
+            }
+            m.index = static_cast<std::uint32_t>(idx % mBytes);
+            bucket(idx / mBytes).push_back(m);
         }
+        // Keep the memory of the bucket for later segments
+        auto done = std::move(mBuckets.front());
+        mBuckets.pop_front();
+        done.clear();
+        mBuckets.push_back(std::move(done));
+        mOffset += 30 * mBytes;
+    }
+}; // SegmentSieve
+
+// Internal function, do not use.
+template <typename T, typename A>
+void do_sieve(std::vector<T, A> &primes, std::vector<unsigned char> &mark,
+        Long &offset, Long limit, std::size_t maxSegmentSize) {
+    // All primes below `offset` are known, so the segment may extend up to the
+    // square of the largest one
+    Long back = primes.back();
+    auto hi = std::min(back * back, std::max(limit, offset));
+    hi = std::min(hi, offset - offset % 30 + 30 * maxSegmentSize - 1);
+
+    sieve_segment(primes, mark, offset, hi, primes.begin(), primes.end());
+    offset = hi + 1;
+}
+
+// Internal function, do not use.
+// Integer square root, rounded down.
+Long isqrt(Long n) {
+    static constexpr Long maxRoot = 0xFFFFFFFF;
+    auto r = std::min(static_cast<Long>(std::sqrt(static_cast<double>(n))),
+            maxRoot);
+    while(r > 0 && r * r > n) {
+        r--;
+    }
+    while(r < maxRoot && (r + 1) * (r + 1) <= n) {
+        r++;
+    }
+    return r;
+}
+
+// Internal function, do not use.
+// Upper bound for the number of primes up to `x`, by Dusart (2010).
+Long prime_count_bound(Long x) {
+    if(x < 2) {
+        return 0;
+    }
+    auto ln = std::log(static_cast<long double>(x));
+    return static_cast<Long>(x / ln * (1 + 1.2762L / ln)) + 1;
+}
+
+// Internal function, do not use.
+// Make room for all primes up to `limit` (and at least the seed primes), so
+// the vector is not reallocated while sieving. The capacity at least doubles,
+// so a vector that is extended repeatedly still grows geometrically.
+template <typename T, typename A>
+void reserve_primes(std::vector<T, A> &primes, Long limit) {
+    std::size_t bound = prime_count_bound(std::max<Long>(limit, seedLimit));
+    if(bound > primes.capacity()) {
+        primes.reserve(std::max(bound, 2 * primes.capacity()));
     }
-    offset += segmentSize + (segmentSize % 2);
 }
 
 /**
  * Fill the specified vector with prime numbers up to the specified limit.
  *
+ * The vector is reserved for an upper bound of the number of primes up to the
+ * limit first, which is at most a few percent too large.
+ *
  * @param primes A vector that will be filled with at least all prime numbers up
  *        to and including `limit`. If the specified vector is not empty, it
  *        must already contain the first `primes.size()` prime numbers. Note
  *        that the vector may be resized when new numbers are added, so all
  *        iterators may be invalidated.
- * @param limit The maximum prime number to be found (inclusive).
+ * @param limit The maximum prime number to be found (inclusive), must fit into
+ *        a `T`.
  */
-void sieve_limit(std::vector<Long> &primes, Long limit) {
-    // The segment size roughly corresponds to the working memory in bytes
+template <typename T, typename A>
+void sieve_limit(std::vector<T, A> &primes, Long limit) {
+    // The segment size is the working memory in bytes, every byte covers 30
+    // integers
     static constexpr std::size_t maxSegmentSize = 250'000;
 
+    reserve_primes(primes, limit);
     if(primes.empty()) {
-        primes = {2, 3, 5, 7, 11, 13, 17, 19};
+        seed_primes(primes);
     }
-    std::vector<char> mark;
-    auto offset = primes.back() + 2;
-    while(offset <= limit) {
+    std::vector<unsigned char> mark;
+    Long offset = primes.back() + 1;
+    // Until the primes reach the square root of the limit, every segment may
+    // only extend up to the square of the largest prime found so far
+    while(offset <= limit && Long(primes.back()) * primes.back() < limit) {
         do_sieve(primes, mark, offset, limit, maxSegmentSize);
     }
+    SegmentSieve segments(offset - offset % 30, maxSegmentSize, limit);
+    while(offset <= limit) {
+        auto base = segments.offset();
+        segments.next(mark, primes);
+        auto hi = std::min(limit, base + 30 * maxSegmentSize - 1);
+        collect_segment(primes, mark, base, offset, hi);
+        offset = hi + 1;
+    }
+}
+
+/**
+ * Fill the specified vector with prime numbers up to the specified limit,
+ * using multiple threads.
+ *
+ * The primes up to `sqrt(limit)` are found first, after that the rest of the
+ * range is split into chunks of segments that are sieved independently by a
+ * pool of worker threads.
+ *
+ * @param primes A vector that will be filled with at least all prime numbers up
+ *        to and including `limit`. If the specified vector is not empty, it
+ *        must already contain the first `primes.size()` prime numbers. Note
+ *        that the vector may be resized when new numbers are added, so all
+ *        iterators may be invalidated.
+ * @param limit The maximum prime number to be found (inclusive), must fit into
+ *        a `T`.
+ * @param threads The number of worker threads, or 0 to use one thread per
+ *        hardware thread.
+ */
+template <typename T, typename A>
+void sieve_limit(std::vector<T, A> &primes, Long limit, unsigned threads) {
+    static constexpr std::size_t maxSegmentSize = 250'000;
+    // Number of segments a worker processes before taking the next chunk
+    static constexpr Long chunkSegments = 4;
+    static constexpr Long chunkSize = 30 * maxSegmentSize * chunkSegments;
+
+    if(threads == 0) {
+        threads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    reserve_primes(primes, limit);
+    sieve_limit(primes, isqrt(limit));
+    Long offset = primes.back() + 1;
+    if(threads == 1 || offset > limit) {
+        sieve_limit(primes, limit);
+        return;
+    }
+
+    // Every worker keeps its own mark buffer, chunks are collected separately
+    // and appended in order once all workers of a round are done. Doing a few
+    // chunks per thread in each round bounds the additional memory needed.
+    std::vector<std::vector<T>> chunks(2 * threads);
+    std::vector<std::vector<unsigned char>> marks(threads);
+    while(offset <= limit) {
+        auto count = std::min<Long>(chunks.size(),
+                (limit - offset) / chunkSize + 1);
+        std::atomic<std::size_t> next(0);
+        auto worker = [&](std::vector<unsigned char> &mark) {
+            for(std::size_t c; (c = next++) < count;) {
+                auto lo = offset + c * chunkSize;
+                auto hi = std::min(limit, lo + chunkSize - 1);
+                chunks[c].clear();
+                SegmentSieve segments(lo - lo % 30, maxSegmentSize, hi);
+                while(lo <= hi) {
+                    auto base = segments.offset();
+                    segments.next(mark, primes);
+                    auto segHi = std::min(hi, base + 30 * maxSegmentSize - 1);
+                    collect_segment(chunks[c], mark, base, lo, segHi);
+                    lo = segHi + 1;
+                }
+            }
+        };
+
+        std::vector<std::thread> pool;
+        for(std::size_t t = 1; t < std::min<Long>(threads, count); t++) {
+            pool.emplace_back(worker, std::ref(marks[t]));
+        }
+        worker(marks[0]);
+        for(auto &t : pool) {
+            t.join();
+        }
+        for(std::size_t c = 0; c < count; c++) {
+            primes.insert(primes.end(), chunks[c].begin(), chunks[c].end());
+        }
+        offset = std::min(limit, offset + count * chunkSize - 1) + 1;
+    }
 }
 
 /**
  * Create a vector with all prime numbers up to the specified limit.
  *
- * @param limit The maximum prime number to be found (inclusive).
+ * The element type can be chosen to save memory, a `std::uint32_t` vector
+ * needs half the space of the default for limits below 2^32.
+ *
+ * @param limit The maximum prime number to be found (inclusive), must fit into
+ *        a `T`.
  * @return A vector with all prime numbers up to and including `limit`.
  */
-std::vector<Long> sieve(Long limit) {
-    std::vector<Long> primes;
+template <typename T = Long, typename A = std::allocator<T>>
+std::vector<T, A> sieve(Long limit) {
+    std::vector<T, A> primes;
     sieve_limit(primes, limit);
+    // The vector may contain more primes than requested
+    primes.erase(std::upper_bound(primes.begin(), primes.end(), limit),
+            primes.end());
     return primes;
 }
 
+// Internal function, do not use.
+// Sieve the range [lo, hi] one segment at a time, `lo` must be greater than 5.
+// For every segment `f(mark, base, segLo, segHi)` is called, where `mark`
+// holds the sieved segment starting at `base` and [segLo, segHi] is the part
+// of the range it covers.
+template <typename F>
+void for_each_segment(Long lo, Long hi, F &&f) {
+    static constexpr std::size_t maxSegmentSize = 250'000;
+
+    auto base = sieve(isqrt(hi));
+    auto offset = lo - lo % 30;
+    std::size_t bytes = std::min<Long>((hi - offset) / 30 + 1, maxSegmentSize);
+    SegmentSieve segments(offset, bytes, hi);
+    std::vector<unsigned char> mark;
+    for(;;) {
+        segments.next(mark, base);
+        if(offset == 0) {
+            // 1 is not a prime number
+            mark[0] &= 0xFE;
+        }
+        // The end of the last segment may not fit into a `Long`, so the loop
+        // stops at `hi` instead of waiting for the offset to pass it
+        auto segHi = hi - offset < 30 * bytes ? hi : offset + 30 * bytes - 1;
+        f(mark, offset, std::max(lo, offset), segHi);
+        if(segHi == hi) {
+            break;
+        }
+        offset = segments.offset();
+    }
+}
+
+// Internal function, do not use.
+// Integer square root of a `Wide`, rounded down.
+Long isqrt(Wide n) {
+    auto r = static_cast<Long>(std::sqrt(static_cast<long double>(n)));
+    while(r > 0 && Wide(r) * r > n) {
+        r--;
+    }
+    while(Wide(r + 1) * (r + 1) <= n) {
+        r++;
+    }
+    return r;
+}
+
+// Internal function, do not use.
+// Like `for_each_segment` for ranges beyond 2^64. Sieving primes above 2^32
+// do not fit into the bucket sieve, so every segment is sieved with all of
+// them. This is only reasonable for ranges much shorter than `sqrt(hi)`.
+template <typename F>
+void for_each_segment(Wide lo, Wide hi, F &&f) {
+    static constexpr std::size_t maxSegmentSize = 250'000;
+
+    std::vector<Long> base;
+    sieve_limit(base, isqrt(hi));
+    Wide offset = lo - lo % 30;
+    std::vector<unsigned char> mark(maxSegmentSize);
+    while(offset <= hi) {
+        std::size_t bytes = std::min<Wide>((hi - offset) / 30 + 1,
+                maxSegmentSize);
+        mark_segment(mark, offset, bytes, base.begin(), base.end());
+        if(offset == 0) {
+            // 1 is not a prime number
+            mark[0] &= 0xFE;
+        }
+        auto segHi = std::min(hi, offset + 30 * bytes - 1);
+        f(mark, offset, std::max(lo, offset), segHi);
+        offset += 30 * bytes;
+    }
+}
+
+/**
+ * Call a function for every prime number in the specified range, without
+ * storing them.
+ *
+ * Only the prime numbers up to `sqrt(hi)` are found before the range is
+ * sieved, so the cost does not depend on how far from 0 the range is, but
+ * only on `sqrt(hi)` and the length of the range.
+ *
+ * The type of the numbers `N` is not deduced from the arguments, it is `Long`
+ * unless specified explicitly. Ranges beyond 2^64 can be sieved with `Wide`,
+ * for example `sieve_range<Wide>(lo, hi, f)`.
+ *
+ * @param lo The start of the range (inclusive).
+ * @param hi The end of the range (inclusive).
+ * @param f The function to be called for every prime number in ascending
+ *        order, with the prime number (an `N`) as its argument.
+ */
+template <typename N = Long, typename F>
+void sieve_range(typename std::common_type<N>::type lo,
+        typename std::common_type<N>::type hi, F &&f) {
+    if(lo > hi) {
+        return;
+    }
+    for(N p : {2, 3, 5}) {
+        if(p >= lo && p <= hi) {
+            f(p);
+        }
+    }
+    lo = std::max(lo, N(7));
+    if(lo > hi) {
+        return;
+    }
+    for_each_segment(lo, hi, [&f](const std::vector<unsigned char> &mark,
+            N base, N segLo, N segHi) {
+        scan_segment(mark, base, segLo, segHi, f);
+    });
+}
+
+/**
+ * Create a vector with all prime numbers in the specified range.
+ *
+ * @param lo The start of the range (inclusive).
+ * @param hi The end of the range (inclusive).
+ * @return A vector with all prime numbers `p` with `lo <= p <= hi`.
+ */
+template <typename N = Long>
+std::vector<N> sieve_range(typename std::common_type<N>::type lo,
+        typename std::common_type<N>::type hi) {
+    std::vector<N> primes;
+    sieve_range<N>(lo, hi, [&primes](N p) { primes.push_back(p); });
+    return primes;
+}
+
+// Internal function, do not use.
+// Bits of the segment byte for the numbers starting at `base` that are in the
+// range [lo, hi].
+unsigned range_mask(Long base, Long lo, Long hi) {
+    unsigned mask = 0;
+    for(unsigned k = 0; k < 8; k++) {
+        // Compared to `hi - base`, since `base + wheel[k]` may wrap
+        if(base + wheel[k] >= lo && wheel[k] <= hi - base) {
+            mask |= 1u << k;
+        }
+    }
+    return mask;
+}
+
+// Internal function, do not use.
+// Call `f(bits, value)` for every byte of the marked segment starting at
+// `base` that overlaps [lo, hi], where `bits` are the set bits of the byte in
+// that range and `value` is the number the byte starts at.
+template <typename F>
+void for_each_byte(const std::vector<unsigned char> &mark, Long base, Long lo,
+        Long hi, F &&f) {
+    std::size_t first = (lo - base) / 30;
+    std::size_t last = (hi - base) / 30;
+    f(mark[first] & range_mask(base + 30 * first, lo, hi), base + 30 * first);
+    for(auto j = first + 1; j < last; j++) {
+        f(mark[j], base + 30 * j);
+    }
+    if(last > first) {
+        f(mark[last] & range_mask(base + 30 * last, lo, hi), base + 30 * last);
+    }
+}
+
+/**
+ * Count the prime numbers in the specified range by sieving it.
+ *
+ * The primes are not stored, every sieved segment is counted by adding up the
+ * number of bits set in it.
+ *
+ * @param lo The start of the range (inclusive).
+ * @param hi The end of the range (inclusive).
+ * @return The number of prime numbers `p` with `lo <= p <= hi`.
+ */
+Long count_primes(Long lo, Long hi) {
+    Long count = 0;
+    sieve_range(lo, std::min(hi, Long(6)), [&count](Long) { count++; });
+    if(hi < 7 || lo > hi) {
+        return count;
+    }
+    for_each_segment(std::max(lo, Long(7)), hi,
+            [&count](const std::vector<unsigned char> &mark, Long base,
+                    Long segLo, Long segHi) {
+        // Whole 64-bit words in the middle, single bytes at the edges
+        std::size_t first = (segLo - base) / 30 + 1;
+        std::size_t last = (segHi - base) / 30;
+        count += __builtin_popcount(mark[first - 1]
+                & range_mask(base + 30 * (first - 1), segLo, segHi));
+        if(last < first) {
+            return;
+        }
+        count += __builtin_popcount(mark[last]
+                & range_mask(base + 30 * last, segLo, segHi));
+        auto j = first;
+        for(; j + 8 <= last; j += 8) {
+            std::uint64_t word;
+            __builtin_memcpy(&word, &mark[j], sizeof(word));
+            count += __builtin_popcountll(word);
+        }
+        for(; j < last; j++) {
+            count += __builtin_popcount(mark[j]);
+        }
+    });
+    return count;
+}
+
+/**
+ * Compute the sum of the prime numbers in the specified range by sieving it.
+ *
+ * The primes are not stored, the sum of every byte of a sieved segment is
+ * computed from the number of bits set in it and a table with the sum of the
+ * wheel residues for all 256 values of a byte.
+ *
+ * @param lo The start of the range (inclusive).
+ * @param hi The end of the range (inclusive).
+ * @return The sum of all prime numbers `p` with `lo <= p <= hi`.
+ */
+Wide sum_primes(Long lo, Long hi) {
+    static const auto residueSums = [] {
+        std::array<Long, 256> sums{};
+        for(unsigned b = 0; b < 256; b++) {
+            for(unsigned k = 0; k < 8; k++) {
+                sums[b] += (b >> k & 1) * wheel[k];
+            }
+        }
+        return sums;
+    }();
+
+    Wide sum = 0;
+    sieve_range(lo, std::min(hi, Long(6)), [&sum](Long p) { sum += p; });
+    if(hi < 7 || lo > hi) {
+        return sum;
+    }
+    for_each_segment(std::max(lo, Long(7)), hi,
+            [&sum](const std::vector<unsigned char> &mark, Long base,
+                    Long segLo, Long segHi) {
+        for_each_byte(mark, base, segLo, segHi,
+                [&sum](unsigned bits, Long value) {
+            sum += static_cast<Wide>(__builtin_popcount(bits)) * value
+                    + residueSums[bits];
+        });
+    });
+    return sum;
+}
+
+/**
+ * Combine all prime numbers in the specified range with a function, without
+ * storing them.
+ *
+ * @param lo The start of the range (inclusive).
+ * @param hi The end of the range (inclusive).
+ * @param init The initial value.
+ * @param op The function combining the value so far with the next prime,
+ *        called as `op(value, p)` for every prime `p` in ascending order.
+ * @return The final value.
+ */
+template <typename T, typename F>
+T reduce_primes(Long lo, Long hi, T init, F op) {
+    sieve_range(lo, hi, [&init, &op](Long p) { init = op(init, p); });
+    return init;
+}
+
 /**
  * Fill the specified vector with prime numbers and return the `n`th number.
  *
@@ -86,20 +958,987 @@ std::vector<Long> sieve(Long limit) {
  * @param n The number of prime numbers to generate (must be positive).
  * @return The `n`th prime number (2 being the 1st prime number).
  */
-Long sieve(std::vector<Long> &primes, std::size_t n) {
+template <typename T, typename A>
+T sieve(std::vector<T, A> &primes, std::size_t n) {
     static constexpr std::size_t maxSegmentSize = 100'000;
 
     if(primes.empty()) {
-        primes = {2, 3, 5, 7, 11, 13, 17, 19};
+        seed_primes(primes);
     }
     if(primes.size() >= n) {
         return primes[n - 1];
     }
 
-    std::vector<char> mark;
-    auto offset = primes.back() + 2;
+    std::vector<unsigned char> mark;
+    Long offset = primes.back() + 1;
     while(primes.size() < n) {
-        do_sieve(primes, mark, offset, 2 * primes.back(), maxSegmentSize);
+        do_sieve(primes, mark, offset, 2 * Long(primes.back()),
+                maxSegmentSize);
     }
     return primes[n - 1];
 }
+
+/**
+ * Represents all prime numbers up to a limit that can be iterated over.
+ *
+ * Unlike `sieve`, the prime numbers are not stored but found one segment at a
+ * time while iterating. Only the prime numbers up to the square root of the
+ * current position and a single segment are kept in memory, so this can be
+ * used to consume primes up to a large limit, for example with
+ * `std::accumulate` or `std::find_if`.
+ */
+class PrimeRange
+{
+    Long mLimit;
+
+public:
+    class iterator
+    {
+        // The state is shared between copies, as for any input iterator only
+        // the most recently incremented copy may be used.
+        struct State
+        {
+            Long limit;
+            std::vector<Long> base;
+            std::vector<unsigned char> mark;
+            SegmentSieve segments;
+            // Start of the current segment, multiple of 30
+            Long offset;
+            std::size_t bytes;
+            std::size_t index;
+            // Bits of `mark[index]` that have not been visited yet
+            unsigned bits;
+        };
+
+        std::shared_ptr<State> mState;
+        Long mValue;
+
+        friend class PrimeRange;
+        iterator() : mState(), mValue(0) {
+        }
+        explicit iterator(Long limit) : mState(), mValue(2) {
+            static constexpr std::size_t maxSegmentSize = 250'000;
+
+            if(limit >= 2) {
+                std::size_t bytes = std::min<Long>(limit / 30 + 1,
+                        maxSegmentSize);
+                // No segment has been sieved yet, the first increment past 5
+                // will sieve the first one
+                mState = std::make_shared<State>(State{limit, {}, {},
+                        SegmentSieve(0, bytes, limit), 0, bytes, bytes, 0});
+                seed_primes(mState->base);
+            }
+        }
+
+        // Sieve the segment following the current one, if there is any.
+        static bool nextSegment(State &s) {
+            // The offset wraps around after a segment ending at 2^64
+            auto next = s.segments.offset();
+            if(next > s.limit || next < s.offset) {
+                return false;
+            }
+            s.offset = next;
+            auto hi = s.offset + std::min<Long>(30 * s.bytes - 1,
+                    s.limit - s.offset);
+            if(s.base.back() < isqrt(hi)) {
+                sieve_limit(s.base, isqrt(hi));
+            }
+            s.segments.next(s.mark, s.base);
+            if(s.offset == 0) {
+                // 1 is not a prime number
+                s.mark[0] &= 0xFE;
+            }
+            s.index = 0;
+            return true;
+        }
+
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = Long;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const Long*;
+        using reference = const Long&;
+
+        iterator(const iterator& other) = default;
+        iterator& operator=(const iterator& other) = default;
+
+        iterator& operator++() {
+            auto &s = *mState;
+            if(mValue < 5) {
+                // 2, 3 and 5 are not part of the wheel
+                mValue = (mValue == 2 ? 3 : 5);
+            } else {
+                while(s.bits == 0) {
+                    if(++s.index >= s.bytes && !nextSegment(s)) {
+                        mState.reset();
+                        return *this;
+                    }
+                    s.bits = s.mark[s.index];
+                }
+                Long delta = 30 * s.index + wheel[__builtin_ctz(s.bits)];
+                s.bits &= s.bits - 1;
+                if(delta > s.limit - s.offset) {
+                    mState.reset();
+                    return *this;
+                }
+                mValue = s.offset + delta;
+            }
+            if(mValue > s.limit) {
+                mState.reset();
+            }
+            return *this;
+        }
+        iterator operator++(int) {
+            iterator tmp(*this);
+            ++(*this);
+            return tmp;
+        }
+
+        bool operator==(const iterator& other) const {
+            return mState == other.mState
+                    && (!mState || mValue == other.mValue);
+        }
+        bool operator!=(const iterator& other) const {
+            return !(*this == other);
+        }
+
+        reference operator*() const {
+            return mValue;
+        }
+        pointer operator->() const {
+            return &mValue;
+        }
+
+        friend void swap(iterator& lhs, iterator& rhs) {
+            std::swap(lhs.mState, rhs.mState);
+            std::swap(lhs.mValue, rhs.mValue);
+        }
+    }; // iterator
+
+    /**
+     * Construct a PrimeRange with all prime numbers up to the specified value.
+     *
+     * @param limit The maximum prime number in the range (inclusive).
+     */
+    explicit PrimeRange(Long limit) : mLimit(limit) {
+    }
+
+    /**
+     * Get an iterator to the first prime number. Every iterator obtained from
+     * this function sieves the range independently.
+     */
+    iterator begin() const {
+        return iterator(mLimit);
+    }
+    iterator end() const {
+        return iterator();
+    }
+}; // PrimeRange
+
+/**
+ * Counts prime numbers up to a limit using the Meissel-Lehmer method.
+ *
+ * Only the prime numbers up to the square root of the limit are stored, the
+ * time needed for a single count is sublinear in the number being counted to.
+ */
+class PrimeCounter
+{
+    // Number of primes whose products are used as wheels for phi
+    static constexpr std::size_t wheelPrimes = 6;
+
+    std::vector<Long> mPrimes;
+    // For `0 < a <= wheelPrimes`: number of integers in [1, x] not divisible by
+    // any of the first `a` primes, for every `x` less than their product
+    std::vector<std::vector<Long>> mPhi;
+
+    // Number of primes up to `x`, where `x` is at most `mPrimes.back()`.
+    Long countSmall(Long x) const {
+        return std::upper_bound(mPrimes.begin(), mPrimes.end(), x)
+                - mPrimes.begin();
+    }
+
+    // Number of integers in [1, x] not divisible by any of the first `a`
+    // primes (Legendre's phi function).
+    Long phi(Long x, std::size_t a) const {
+        if(a == 0) {
+            return x;
+        }
+        if(a <= wheelPrimes) {
+            const auto &table = mPhi[a];
+            return (x / table.size()) * table.back() + table[x % table.size()];
+        }
+        if(x < mPrimes[a - 1]) {
+            // Only 1 is left
+            return x > 0 ? 1 : 0;
+        }
+        if(x <= mPrimes.back() && x < mPrimes[a] * mPrimes[a]) {
+            // Everything left is either 1 or a prime greater than the a-th
+            return countSmall(x) - a + 1;
+        }
+        auto result = phi(x, wheelPrimes);
+        for(auto i = wheelPrimes; i < a; i++) {
+            result -= phi(x / mPrimes[i], i);
+        }
+        return result;
+    }
+
+public:
+    /**
+     * Construct a PrimeCounter for numbers up to the specified limit.
+     *
+     * @param limit The maximum number that can be counted to (inclusive).
+     */
+    explicit PrimeCounter(Long limit) {
+        sieve_limit(mPrimes, isqrt(limit) + 1);
+        mPhi.resize(wheelPrimes + 1);
+        Long product = 1;
+        for(std::size_t a = 1; a <= wheelPrimes; a++) {
+            product *= mPrimes[a - 1];
+            auto &table = mPhi[a];
+            table.resize(product);
+            for(Long x = 1; x < product; x++) {
+                auto coprime = std::all_of(mPrimes.begin(),
+                        mPrimes.begin() + a,
+                        [x](Long p) { return x % p != 0; });
+                table[x] = table[x - 1] + coprime;
+            }
+        }
+    }
+
+    /**
+     * Count the prime numbers up to and including the specified number.
+     *
+     * @param x The number to count primes up to, must not be greater than the
+     *        limit this counter was constructed with.
+     * @return The number of primes less than or equal to `x`.
+     */
+    Long operator()(Long x) const {
+        if(x <= mPrimes.back()) {
+            return countSmall(x);
+        }
+        auto sqrtX = isqrt(x);
+        auto cbrtX = static_cast<Long>(std::cbrt(static_cast<double>(x)));
+        while(cbrtX * cbrtX * cbrtX > x) {
+            cbrtX--;
+        }
+        while((cbrtX + 1) * (cbrtX + 1) * (cbrtX + 1) <= x) {
+            cbrtX++;
+        }
+        auto a = countSmall(isqrt(sqrtX));
+        auto b = countSmall(sqrtX);
+        auto c = countSmall(cbrtX);
+
+        // Lehmer's formula, with primes indexed from 1
+        auto result = phi(x, a) + (b + a - 2) * (b - a + 1) / 2;
+        for(auto i = a + 1; i <= b; i++) {
+            auto w = x / mPrimes[i - 1];
+            result -= (*this)(w);
+            if(i <= c) {
+                auto bi = countSmall(isqrt(w));
+                for(auto j = i; j <= bi; j++) {
+                    result -= countSmall(w / mPrimes[j - 1]) - (j - 1);
+                }
+            }
+        }
+        return result;
+    }
+}; // PrimeCounter
+
+/**
+ * Count the prime numbers up to and including the specified number.
+ *
+ * @param x The number to count primes up to.
+ * @return The number of primes less than or equal to `x`.
+ */
+Long prime_count(Long x) {
+    return PrimeCounter(x)(x);
+}
+
+/**
+ * Find the `n`th prime number without storing all prime numbers before it.
+ *
+ * The prime is bracketed with analytic bounds, the primes up to the lower
+ * bound are counted with a `PrimeCounter` and only the gap between the bound
+ * and the result is sieved.
+ *
+ * @param n The index of the prime number to find (must be positive).
+ * @return The `n`th prime number (2 being the 1st prime number).
+ */
+Long nth_prime(std::size_t n) {
+    static constexpr Long small[] = {2, 3, 5, 7, 11};
+    static constexpr std::size_t maxSegmentSize = 250'000;
+
+    if(n <= 5) {
+        return small[n - 1];
+    }
+    // Bounds by Dusart (2010), the lower one holds for n >= 3, the upper one
+    // (by Rosser) for n >= 6
+    auto ln = std::log(static_cast<long double>(n));
+    auto lnln = std::log(ln);
+    auto lower = std::max(static_cast<Long>(
+            n * (ln + lnln - 1 + (lnln - 2.1L) / ln)), Long(5));
+    auto upper = static_cast<Long>(n * (ln + lnln)) + 1;
+
+    PrimeCounter counter(upper);
+    auto count = counter(lower);
+    std::vector<Long> base;
+    sieve_limit(base, isqrt(upper) + 1);
+
+    std::vector<Long> found;
+    std::vector<unsigned char> mark;
+    for(auto lo = lower + 1;; lo = lo - lo % 30 + 30 * maxSegmentSize) {
+        auto hi = lo - lo % 30 + 30 * maxSegmentSize - 1;
+        found.clear();
+        sieve_segment(found, mark, lo, hi, base.begin(), base.end());
+        if(count + found.size() >= n) {
+            return found[n - count - 1];
+        }
+        count += found.size();
+    }
+}
+
+/**
+ * Counts and sums prime numbers up to a limit using Lucy Hedgehog's dynamic
+ * program over the floor quotients of the limit.
+ *
+ * For every value `v = n / k` the number and the sum of the integers in
+ * [2, v] that have no prime factor below `p` are kept and updated for every
+ * prime `p` up to `sqrt(n)`, until only primes are left. This needs
+ * O(n^(3/4)) time and O(sqrt(n)) memory, so limits around 1e13 are fine where
+ * sieving all primes is not. The sums use 128-bit integers.
+ */
+class PrimeSum
+{
+    // Minimum number of values updated for a single prime to split the update
+    // between threads
+    static constexpr Long minParallel = 1 << 16;
+
+    Long mLimit;
+    Long mRoot;
+    // Greatest value below the quotients `n / i` for `i <= mRoot`, all values
+    // from 1 to `mSmall` are stored after them
+    Long mSmall;
+    // Values in descending order: `n / 1, ..., n / mRoot, mSmall, ..., 1`
+    std::vector<Long> mCount;
+    std::vector<Wide> mSum;
+
+    std::size_t index(Long v) const {
+        return v <= mSmall ? mCount.size() - v : mLimit / v - 1;
+    }
+
+    // Value at the specified index.
+    Long value(std::size_t j) const {
+        return j < mRoot ? mLimit / (j + 1) : mCount.size() - j;
+    }
+
+    // Compute the values at [first, last) after removing multiples of the
+    // prime `p`, reading the values before that from `mCount` and `mSum`.
+    void update(Long p, std::size_t first, std::size_t last, Long *count,
+            Wide *sum) const {
+        auto countBelow = mCount[index(p - 1)];
+        auto sumBelow = mSum[index(p - 1)];
+        for(auto j = first; j < last; j++) {
+            // Index of `value(j) / p`, without dividing twice if possible
+            std::size_t q;
+            if(j < mRoot) {
+                auto i = (j + 1) * p;
+                q = i <= mRoot ? i - 1 : mCount.size() - mLimit / i;
+            } else {
+                q = mCount.size() - value(j) / p;
+            }
+            count[j - first] = mCount[j] - (mCount[q] - countBelow);
+            sum[j - first] = mSum[j] - p * (mSum[q] - sumBelow);
+        }
+    }
+
+public:
+    /**
+     * Count and sum the prime numbers up to the specified limit.
+     *
+     * @param limit The maximum number to count primes up to (inclusive).
+     * @param threads The number of worker threads, or 0 to use one thread per
+     *        hardware thread.
+     */
+    explicit PrimeSum(Long limit, unsigned threads = 1)
+            : mLimit(limit), mRoot(isqrt(limit)) {
+        if(threads == 0) {
+            threads = std::max(std::thread::hardware_concurrency(), 1u);
+        }
+        mSmall = std::min(mRoot, limit / std::max(mRoot, Long(1)) - 1);
+        auto size = mRoot + mSmall;
+        mCount.resize(size);
+        mSum.resize(size);
+        for(std::size_t j = 0; j < size; j++) {
+            auto v = value(j);
+            mCount[j] = v - 1;
+            // Divide before multiplying, v (v + 1) may not fit into 128 bits
+            mSum[j] = (v % 2 == 0 ? Wide(v / 2) * (v + 1)
+                    : Wide(v) * (v / 2 + 1)) - 1;
+        }
+
+        std::vector<Long> count;
+        std::vector<Wide> sum;
+        for(Long p = 2; p <= mRoot; p++) {
+            if(mCount[index(p)] == mCount[index(p - 1)]) {
+                continue;
+            }
+            // Only values of at least p^2 change
+            auto p2 = p * p;
+            std::size_t last = p2 <= mSmall ? size - p2 + 1 : limit / p2;
+            if(threads == 1 || last < minParallel) {
+                // In ascending order every value is read before it changes, so
+                // the update can be done in place
+                update(p, 0, last, mCount.data(), mSum.data());
+                continue;
+            }
+            count.resize(last);
+            sum.resize(last);
+            std::vector<std::thread> pool;
+            auto chunk = (last + threads - 1) / threads;
+            for(std::size_t first = 0; first < last; first += chunk) {
+                auto end = std::min(first + chunk, last);
+                pool.emplace_back(&PrimeSum::update, this, p, first, end,
+                        &count[first], &sum[first]);
+            }
+            for(auto &t : pool) {
+                t.join();
+            }
+            std::copy(count.begin(), count.end(), mCount.begin());
+            std::copy(sum.begin(), sum.end(), mSum.begin());
+        }
+    }
+
+    /**
+     * Get the limit this object was constructed with.
+     */
+    Long limit() const {
+        return mLimit;
+    }
+
+    /**
+     * Count the prime numbers up to the specified number.
+     *
+     * @param v The number to count primes up to, must be `limit() / k` for
+     *        some positive integer `k`.
+     * @return The number of primes less than or equal to `v`.
+     */
+    Long count(Long v) const {
+        return v == 0 ? 0 : mCount[index(v)];
+    }
+
+    /**
+     * Compute the sum of the prime numbers up to the specified number.
+     *
+     * @param v The number to sum primes up to, must be `limit() / k` for some
+     *        positive integer `k`.
+     * @return The sum of all primes less than or equal to `v`.
+     */
+    Wide sum(Long v) const {
+        return v == 0 ? 0 : mSum[index(v)];
+    }
+}; // PrimeSum
+
+/**
+ * Compute the sum of the prime numbers up to and including the specified
+ * number, without sieving them.
+ *
+ * @param x The number to sum primes up to.
+ * @param threads The number of worker threads, or 0 to use one thread per
+ *        hardware thread.
+ * @return The sum of all primes less than or equal to `x`.
+ */
+Wide prime_sum(Long x, unsigned threads = 1) {
+    return PrimeSum(x, threads).sum(x);
+}
+
+/**
+ * A read-only table of all prime numbers up to a limit, stored compactly.
+ *
+ * The primes are stored as gaps between consecutive odd primes, halved and
+ * packed into one byte each (gaps of more than 510 are stored as a zero byte
+ * followed by two bytes). The first prime of every block of `blockSize` primes
+ * is stored with its absolute value, so any prime can be found by decoding at
+ * most one block. This needs a little more than one byte per prime instead of
+ * the eight bytes of a `std::vector<Long>`.
+ */
+class PrimeTable
+{
+    static constexpr std::size_t blockSize = 128;
+
+    std::vector<unsigned char> mGaps;
+    // First prime and offset into `mGaps` of every block of odd primes
+    std::vector<Long> mFirst;
+    std::vector<std::size_t> mOffset;
+    std::size_t mSize;
+
+    // Decode the gap starting at `mGaps[pos]` and advance `pos`.
+    Long nextGap(std::size_t &pos) const {
+        Long half = mGaps[pos++];
+        if(half == 0) {
+            half = mGaps[pos] | (mGaps[pos + 1] << 8);
+            pos += 2;
+        }
+        return 2 * half;
+    }
+
+    // Number of odd primes in the specified block.
+    std::size_t blockLength(std::size_t block) const {
+        auto rest = mSize - 1 - block * blockSize;
+        return rest < blockSize ? rest : blockSize;
+    }
+
+    // Index of the block that would contain the odd number `x`.
+    std::size_t findBlock(Long x) const {
+        return std::upper_bound(mFirst.begin(), mFirst.end(), x)
+                - mFirst.begin() - 1;
+    }
+
+public:
+    class iterator
+    {
+        const PrimeTable *mTable;
+        // Index of the current odd prime, `-1` for 2
+        std::size_t mIndex;
+        std::size_t mPos;
+        Long mValue;
+
+        friend class PrimeTable;
+        iterator(const PrimeTable *table, std::size_t index, std::size_t pos,
+                Long value)
+                : mTable(table), mIndex(index), mPos(pos), mValue(value) {
+        }
+
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = Long;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const Long*;
+        using reference = const Long&;
+
+        iterator(const iterator& other) = default;
+        iterator& operator=(const iterator& other) = default;
+
+        iterator& operator++() {
+            if(++mIndex >= mTable->mSize - 1) {
+                // Past the end, the value is not used anymore
+            } else if(mIndex % blockSize == 0) {
+                mValue = mTable->mFirst[mIndex / blockSize];
+                mPos = mTable->mOffset[mIndex / blockSize];
+            } else {
+                mValue += mTable->nextGap(mPos);
+            }
+            return *this;
+        }
+        iterator operator++(int) {
+            iterator tmp(*this);
+            ++(*this);
+            return tmp;
+        }
+
+        bool operator==(const iterator& other) const {
+            return mIndex == other.mIndex;
+        }
+        bool operator!=(const iterator& other) const {
+            return !(*this == other);
+        }
+
+        reference operator*() const {
+            return mValue;
+        }
+        pointer operator->() const {
+            return &mValue;
+        }
+
+        friend void swap(iterator& lhs, iterator& rhs) {
+            std::swap(lhs.mTable, rhs.mTable);
+            std::swap(lhs.mIndex, rhs.mIndex);
+            std::swap(lhs.mPos, rhs.mPos);
+            std::swap(lhs.mValue, rhs.mValue);
+        }
+    }; // iterator
+
+    /**
+     * Construct a PrimeTable with all prime numbers up to the specified limit.
+     *
+     * @param limit The maximum prime number to be stored (inclusive).
+     */
+    explicit PrimeTable(Long limit) : mSize(0) {
+        PrimeRange primes(limit);
+        Long last = 0;
+        for(auto p : primes) {
+            if(p == 2) {
+                // Not stored, since the gap to 3 is odd
+            } else if((mSize - 1) % blockSize == 0) {
+                mFirst.push_back(p);
+                mOffset.push_back(mGaps.size());
+            } else {
+                auto half = (p - last) / 2;
+                if(half < 256) {
+                    mGaps.push_back(static_cast<unsigned char>(half));
+                } else {
+                    mGaps.push_back(0);
+                    mGaps.push_back(static_cast<unsigned char>(half));
+                    mGaps.push_back(static_cast<unsigned char>(half >> 8));
+                }
+            }
+            last = p;
+            mSize++;
+        }
+        mGaps.shrink_to_fit();
+        mFirst.shrink_to_fit();
+        mOffset.shrink_to_fit();
+    }
+
+    /**
+     * Get the number of prime numbers in the table.
+     */
+    std::size_t size() const {
+        return mSize;
+    }
+
+    /**
+     * Get the `n`th prime number (select).
+     *
+     * @param n The index of the prime number, must be positive and not
+     *        greater than `size()`.
+     * @return The `n`th prime number (2 being the 1st prime number).
+     */
+    Long nth(std::size_t n) const {
+        if(n == 1) {
+            return 2;
+        }
+        auto index = n - 2;
+        auto pos = mOffset[index / blockSize];
+        auto value = mFirst[index / blockSize];
+        for(auto j = index % blockSize; j > 0; j--) {
+            value += nextGap(pos);
+        }
+        return value;
+    }
+
+    /**
+     * Count the prime numbers less than or equal to the specified number
+     * (rank).
+     *
+     * @param x The number to count primes up to.
+     * @return The number of primes in the table that are not greater than `x`.
+     */
+    std::size_t count_le(Long x) const {
+        if(x < 3 || mFirst.empty()) {
+            return x < 2 || mSize == 0 ? 0 : 1;
+        }
+        auto block = findBlock(x);
+        auto pos = mOffset[block];
+        auto value = mFirst[block];
+        std::size_t count = 2 + block * blockSize;
+        auto end = blockLength(block);
+        for(std::size_t j = 1; j < end; j++) {
+            value += nextGap(pos);
+            if(value > x) {
+                break;
+            }
+            count++;
+        }
+        return count;
+    }
+
+    /**
+     * Test whether the specified number is in the table.
+     *
+     * @param x The number to test.
+     * @return `true` if `x` is prime and in the table, `false` otherwise.
+     */
+    bool contains(Long x) const {
+        if(x < 3 || x % 2 == 0 || mFirst.empty()) {
+            return x == 2 && mSize > 0;
+        }
+        auto block = findBlock(x);
+        auto pos = mOffset[block];
+        auto value = mFirst[block];
+        auto end = blockLength(block);
+        for(std::size_t j = 1; j < end && value < x; j++) {
+            value += nextGap(pos);
+        }
+        return value == x;
+    }
+
+    iterator begin() const {
+        return iterator(this, mSize == 0 ? 0 : std::size_t(-1), 0, 2);
+    }
+    iterator end() const {
+        return iterator(this, mSize == 0 ? 0 : mSize - 1, 0, 0);
+    }
+}; // PrimeTable
+
+// Internal class, do not use.
+// Modular arithmetic in Montgomery form for an odd 64-bit modulus, with
+// R = 2^64.
+class Montgomery
+{
+    Long mN;
+    // n^-1 mod 2^64
+    Long mInv;
+    // R^2 mod n
+    Long mR2;
+
+public:
+    explicit Montgomery(Long n) : mN(n), mInv(n) {
+        // Newton's iteration doubles the number of correct bits each step,
+        // starting with 3 correct bits (n * n = 1 mod 8 for odd n)
+        for(int j = 0; j < 5; j++) {
+            mInv *= 2 - n * mInv;
+        }
+        auto r = static_cast<Wide>(-n % n);
+        mR2 = static_cast<Long>(r * r % n);
+    }
+
+    // Compute `t / R mod n` for `t < n R`.
+    Long reduce(Wide t) const {
+        auto m = static_cast<Long>(t) * mInv;
+        auto hi = static_cast<Long>(t >> 64);
+        auto mn = static_cast<Long>((static_cast<Wide>(m) * mN) >> 64);
+        return hi >= mn ? hi - mn : hi - mn + mN;
+    }
+
+    Long modulus() const {
+        return mN;
+    }
+
+    Long add(Long a, Long b) const {
+        // The sum may overflow for moduli above 2^63
+        auto sum = a + b;
+        return (sum >= mN || sum < a) ? sum - mN : sum;
+    }
+
+    Long mul(Long a, Long b) const {
+        return reduce(static_cast<Wide>(a) * b);
+    }
+
+    Long to(Long a) const {
+        return mul(a % mN, mR2);
+    }
+
+    Long from(Long a) const {
+        return reduce(a);
+    }
+
+    Long pow(Long a, Long e) const {
+        auto result = to(1);
+        for(; e > 0; e >>= 1) {
+            if(e & 1) {
+                result = mul(result, a);
+            }
+            a = mul(a, a);
+        }
+        return result;
+    }
+}; // Montgomery
+
+/**
+ * Test whether the specified number is prime, without sieving.
+ *
+ * Small factors are found with trial division, all other numbers are tested
+ * with a deterministic Miller-Rabin test (using a set of seven bases that is
+ * known to be correct for all 64-bit numbers).
+ *
+ * @param n The number to test.
+ * @return `true` if `n` is prime, `false` otherwise.
+ */
+bool is_prime(Long n) {
+    static constexpr Long small[] = {2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31,
+            37, 41, 43, 47};
+    static constexpr Long bases[] = {2, 325, 9'375, 28'178, 450'775,
+            9'780'504, 1'795'265'022};
+
+    if(n < 2) {
+        return false;
+    }
+    for(auto p : small) {
+        if(n % p == 0) {
+            return n == p;
+        }
+    }
+    if(n < 53 * 53) {
+        return true;
+    }
+
+    // n - 1 = d 2^s with odd d
+    auto s = __builtin_ctzll(n - 1);
+    auto d = (n - 1) >> s;
+    Montgomery mont(n);
+    auto one = mont.to(1);
+    auto minusOne = mont.to(n - 1);
+    for(auto a : bases) {
+        if(a % n == 0) {
+            continue;
+        }
+        auto x = mont.pow(mont.to(a), d);
+        if(x == one || x == minusOne) {
+            continue;
+        }
+        auto composite = true;
+        for(int r = 1; r < s && composite; r++) {
+            x = mont.mul(x, x);
+            composite = (x != minusOne);
+        }
+        if(composite) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Tests numbers for primality, using a precomputed bitset for small numbers.
+ *
+ * Numbers up to the threshold are looked up in a wheel bitset (one bit per
+ * number coprime to 30, so the threshold divided by 30 bytes), larger numbers
+ * are tested with `is_prime`. Either way a test costs at most `O(log n)`.
+ */
+class PrimeTest
+{
+    Long mThreshold;
+    std::vector<unsigned char> mBits;
+
+public:
+    /**
+     * Construct a PrimeTest with the specified bitset size.
+     *
+     * @param threshold The largest number to be looked up in the bitset.
+     */
+    explicit PrimeTest(Long threshold = 1 << 24) : mThreshold(threshold) {
+        // Sieve in cache sized segments and copy them into the bitset
+        mBits.resize(threshold / 30 + 1);
+        for_each_segment(Long(7), 30 * mBits.size() - 1,
+                [this](const std::vector<unsigned char> &mark, Long base,
+                        Long, Long hi) {
+            std::copy_n(mark.begin(), (hi - base) / 30 + 1,
+                    mBits.begin() + base / 30);
+        });
+    }
+
+    /**
+     * Test whether the specified number is prime.
+     *
+     * @param n The number to test.
+     * @return `true` if `n` is prime, `false` otherwise.
+     */
+    bool operator()(Long n) const {
+        if(n > mThreshold) {
+            return is_prime(n);
+        }
+        if(n < 7) {
+            return n == 2 || n == 3 || n == 5;
+        }
+        auto bit = wheelIndex[n % 30];
+        return bit < 8 && (mBits[n / 30] >> bit & 1) != 0;
+    }
+}; // PrimeTest
+
+/**
+ * Tests numbers for primality from multiple threads, using a bitset that
+ * grows on demand.
+ *
+ * Readers look numbers up in an immutable snapshot of the bitset without
+ * taking any lock. When a number is not covered, a single writer at a time
+ * sieves a larger snapshot (at least twice the size of the current one) and
+ * publishes it with an atomic pointer swap. Old snapshots are kept until the
+ * cache is destroyed, since readers may still be using them; with the size
+ * doubling they take at most as much memory as the current one.
+ */
+class SharedPrimeCache
+{
+    struct Snapshot
+    {
+        Long limit;
+        std::vector<unsigned char> bits;
+    };
+
+    static constexpr std::size_t maxSegmentSize = 250'000;
+
+    Long mMaxLimit;
+    std::atomic<const Snapshot*> mCurrent;
+    std::mutex mWriter;
+    std::vector<std::unique_ptr<const Snapshot>> mSnapshots;
+
+    // Publish a snapshot covering at least `n`.
+    const Snapshot *extend(Long n) {
+        std::lock_guard<std::mutex> lock(mWriter);
+        auto current = mCurrent.load(std::memory_order_relaxed);
+        if(current != nullptr && current->limit >= n) {
+            // Another thread was faster
+            return current;
+        }
+
+        std::size_t oldBytes = current != nullptr ? current->bits.size() : 0;
+        auto bytes = std::max<Long>(2 * oldBytes, n / 30 + 1);
+        bytes = std::min(bytes, mMaxLimit / 30 + 1);
+        std::unique_ptr<Snapshot> next(new Snapshot{30 * bytes - 1, {}});
+        next->bits.reserve(bytes);
+        if(current != nullptr) {
+            next->bits = current->bits;
+        }
+
+        std::vector<Long> base;
+        sieve_limit(base, isqrt(next->limit) + 1);
+        std::vector<unsigned char> mark;
+        for(auto offset = oldBytes; offset < bytes;) {
+            std::size_t count = std::min<Long>(bytes - offset, maxSegmentSize);
+            mark.resize(count);
+            mark_segment(mark, 30 * offset, count, base.begin(), base.end());
+            if(offset == 0) {
+                // 1 is not a prime number
+                mark[0] &= 0xFE;
+            }
+            next->bits.insert(next->bits.end(), mark.begin(), mark.end());
+            offset += count;
+        }
+
+        mSnapshots.emplace_back(std::move(next));
+        current = mSnapshots.back().get();
+        mCurrent.store(current, std::memory_order_release);
+        return current;
+    }
+
+public:
+    /**
+     * Construct an empty SharedPrimeCache.
+     *
+     * @param maxLimit The largest number to be looked up in the bitset,
+     *        larger numbers are tested with `is_prime` instead of growing the
+     *        cache any further.
+     */
+    explicit SharedPrimeCache(Long maxLimit = Long(1) << 32)
+            : mMaxLimit(maxLimit), mCurrent(nullptr) {
+    }
+
+    SharedPrimeCache(const SharedPrimeCache&) = delete;
+    SharedPrimeCache& operator=(const SharedPrimeCache&) = delete;
+
+    /**
+     * Test whether the specified number is prime. This function may be
+     * called from multiple threads at the same time.
+     *
+     * @param n The number to test.
+     * @return `true` if `n` is prime, `false` otherwise.
+     */
+    bool operator()(Long n) {
+        if(n > mMaxLimit) {
+            return is_prime(n);
+        }
+        if(n < 7) {
+            return n == 2 || n == 3 || n == 5;
+        }
+        auto bit = wheelIndex[n % 30];
+        if(bit == 8) {
+            return false;
+        }
+        auto current = mCurrent.load(std::memory_order_acquire);
+        if(current == nullptr || current->limit < n) {
+            current = extend(n);
+        }
+        return (current->bits[n / 30] >> bit & 1) != 0;
+    }
+}; // SharedPrimeCache
+
+#endif // SIEVE_HPP